@@ -8,6 +8,7 @@
 
 #include "KoraConfig.h"
 #include "Kora.h"
+#include "trace.h"
 #include <string.h>
 
 #if CFG_ALLOW_DYNAMIC_ALLOC
@@ -148,6 +149,7 @@ void* os_malloc(int size){
 		min_left = info.remain_size;
 
 	enable_task_switch();
+	TRACE(trace_malloc, (u_int)new_block + sizeof(header_t));
 	return (void*)((u_int)new_block + sizeof(header_t));
 }
 
@@ -173,6 +175,7 @@ void os_free(void *addr){
 		return;
 	}
 
+	TRACE(trace_free, addr);
 	disable_task_switch();
 	block_t* rls = (block_t*)header;
 	const u_int rls_size = header->size + sizeof(header_t);
@@ -0,0 +1,151 @@
+/*
+ * Kora rtos
+ * Copyright (c) 2024 biaboi
+ *
+ * This file is part of this project and is licensed under the MIT License.
+ * See the LICENSE file in the project root for full license information.
+ */
+
+
+#include "Kora.h"
+#include "btask.h"
+
+/**
+ * @file    btask.c
+ * @brief   Run-to-completion tasks sharing one stack per priority level.
+ *
+ * Each level is served by one level task. btask_activate() counts the
+ * activation and queues the basic task on its level in FIFO order, the level
+ * task takes them one by one and calls their handlers, then blocks when the
+ * queue is empty. A higher level preempts a lower one as ordinary tasks do,
+ * so only one stack per used priority is needed instead of one per handler.
+ *
+ * A handler must not block, otherwise every basic task of its level waits.
+ */
+
+#if CFG_USE_BASIC_TASK
+
+#define NODE_TO_BTASK(pnode)   ((btask*)( (u_int)(pnode) - offsetof(btask, node)) )
+
+typedef struct {
+	task_handle   runner;
+	list_t        activated;     // basic tasks waiting to run, FIFO
+	list_t        idle_wait;     // the level task blocks here when nothing to run
+} btask_level_t;
+
+static btask_level_t  *levels[CFG_MAX_PRIOS];
+
+
+static void level_task(void *para){
+	btask_level_t *lv = para;
+
+	enter_critical();
+	while (1){
+		if (LIST_IS_EMPTY(&lv->activated)){
+			block(&lv->idle_wait, FOREVER);
+			continue;
+		}
+
+		// run one activation, a task activated several times goes to the 
+		// end so that others of the level are not starved
+		btask *bt = NODE_TO_BTASK(FIRST_OF(lv->activated));
+		list_remove(&bt->node);
+		if (--bt->pending > 0)
+			list_insert_end(&lv->activated, &bt->node);
+		exit_critical();
+
+		bt->handler(bt->para);
+		bt->runs += 1;
+		enter_critical();
+	}
+}
+
+
+static task_handle level_start(u_int prio, btask_level_t *lv, u_char *stack, int size){
+	os_assert(prio < CFG_MAX_PRIOS && levels[prio] == NULL);
+
+	list_init(&lv->activated);
+	list_init(&lv->idle_wait);
+
+	char name[] = "btask_xxx";
+	name[6] = '0' + prio / 100;
+	name[7] = '0' + prio / 10 % 10;
+	name[8] = '0' + prio % 10;
+
+	if (stack != NULL)
+		lv->runner = task_init(level_task, name, lv, prio, stack, size);
+	else
+		lv->runner = task_create(level_task, name, lv, prio, size);
+
+	if (lv->runner != NULL)
+		levels[prio] = lv;
+	return lv->runner;
+}
+
+
+/*
+@ brief: Create the level task that runs the basic tasks of priority prio.
+@ param: stack -> shared by all basic tasks of the level, size must cover the 
+                  deepest handler.
+*/
+task_handle btask_level_init(u_int prio, u_char *stack, int size){
+	static btask_level_t level_pool[CFG_BASIC_TASK_LEVELS];
+	static int used = 0;
+
+	os_assert(used < CFG_BASIC_TASK_LEVELS);
+	return level_start(prio, level_pool + used++, stack, size);
+}
+
+
+task_handle btask_level_create(u_int prio, int size){
+	btask_level_t *lv = malloc(sizeof(btask_level_t));
+	if (lv == NULL)
+		return NULL;
+
+	task_handle runner = level_start(prio, lv, NULL, size);
+	if (runner == NULL)
+		free(lv);
+	return runner;
+}
+
+
+/*
+@ brief: Initialize a basic task, the level of prio must have been created.
+*/
+void btask_init(btask_t bt, vfunc handler, void *para, u_int prio){
+	os_assert(prio < CFG_MAX_PRIOS && levels[prio] != NULL);
+
+	LIST_NODE_INIT(&bt->node);
+	bt->handler = handler;
+	bt->para = para;
+	bt->prio = prio;
+	bt->pending = 0;
+	bt->runs = 0;
+}
+
+
+/*
+@ brief: Activate the basic task, its handler will run once more.
+@ note: Never blocks, can be called in isr.
+@ retv: RET_SUCCESS / RET_FAILED(too many activations pending)
+*/
+int btask_activate(btask_t bt){
+	btask_level_t *lv = levels[bt->prio];
+
+	enter_critical();
+	if (bt->pending == USHRT_MAX){
+		exit_critical();
+		return RET_FAILED;
+	}
+
+	if (bt->pending++ == 0)
+		list_insert_end(&lv->activated, &bt->node);
+
+	if (LIST_NOT_EMPTY(&lv->idle_wait))
+		task_ready_isr(lv->runner);
+
+	exit_critical();
+	return RET_SUCCESS;
+}
+
+#endif  // CFG_USE_BASIC_TASK
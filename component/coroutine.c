@@ -0,0 +1,269 @@
+/*
+ * Kora rtos
+ * Copyright (c) 2024 biaboi
+ *
+ * This file is part of this project and is licensed under the MIT License.
+ * See the LICENSE file in the project root for full license information.
+ */
+
+
+#include "Kora.h"
+#include "coroutine.h"
+
+/**
+ * @file    coroutine.c
+ * @brief   One host task that runs all stackless coroutines.
+ *
+ * Ready coroutines are kept in a FIFO list, the host takes the first one,
+ * calls it and puts it back according to what it returned, so picking and
+ * requeueing are O(1) whatever the number of coroutines.
+ *
+ * Sleeping coroutines are mounted on a timer wheel and run once expired.
+ * A coroutine waiting on a kernel object is mounted on the co_list of the
+ * object, the give paths of the object call co_notify() to make the first one
+ * ready, a timed wait is also on the wheel for its deadline. Only CO_AWAIT
+ * conditions are polled, each is run once per tick, co_wake() can be used by 
+ * the producer to resume it without the delay. The host takes one coroutine 
+ * per critical section, so interrupts are never masked for a whole list.
+ *
+ * The host sleeps when nothing is ready, until the next sleeper expires, the
+ * next tick if anything polls, or forever.
+ */
+
+#if CFG_USE_COROUTINE
+
+#define NODE_TO_CO(pnode)        ((co_t*)( (u_int)(pnode) - offsetof(co_t, node)) )
+#define WAIT_NODE_TO_CO(pnode)   ((co_t*)( (u_int)(pnode) - offsetof(co_t, wait_node)) )
+
+static list_t         ready_list;
+static list_t         poll_list;
+static timer_wheel    sleepers;
+static int            sleeper_nums = 0;
+static int            co_nums = 0;
+
+static list_t         host_wait;           // the host task blocks here when nothing is ready
+static task_handle    host = NULL;
+static u_char         host_stack[CFG_COROUTINE_STACK_SIZE];
+
+
+// ticks the host can sleep when nothing is ready, in critical
+static u_int idle_ticks(void){
+	if (LIST_NOT_EMPTY(&poll_list))
+		return 1;
+
+	if (sleeper_nums > 0)
+		return timer_wheel_next_expire(&sleepers, os_get_tick());
+
+	return FOREVER;
+}
+
+
+/*
+@ brief: Take the next coroutine to run, in critical.
+@ note: One node is taken per call, so each critical section of the host is 
+        short whatever the number of coroutines. Due sleepers come first, then
+        the coroutines that were polling when the tick began, then the ready ones.
+*/
+static co_t* take_next(u_int *poll_round){
+	list_t *expired = TIMER_WHEEL_EXPIRED(&sleepers);
+	list_node_t *node;
+
+	if (LIST_NOT_EMPTY(expired)){
+		node = FIRST_OF(*expired);
+		--sleeper_nums;
+	}
+	else if (*poll_round > 0 && LIST_NOT_EMPTY(&poll_list)){
+		node = FIRST_OF(poll_list);
+		--*poll_round;
+	}
+	else if (LIST_NOT_EMPTY(&ready_list))
+		node = FIRST_OF(ready_list);
+	else
+		return NULL;
+
+	list_remove(node);
+	co_t *co = NODE_TO_CO(node);
+	list_remove(&co->wait_node);    // a wait timed out
+	return co;
+}
+
+
+static void host_task(void *nothing){
+	u_int last_poll = os_get_tick();
+	u_int poll_round = 0;      // polling coroutines left to check in this tick
+
+	enter_critical();
+	while (1){
+		u_int now = os_get_tick();
+		// after a long block the sleepers catch up in bounded steps, interrupts
+		// are served between them, an empty wheel jumps to now at once
+		while (sleeper_nums > 0 && now - sleepers.now > TW_SLOTS){
+			timer_wheel_advance(&sleepers, sleepers.now + TW_SLOTS);
+			exit_critical();
+			enter_critical();
+		}
+		timer_wheel_advance(&sleepers, now);
+		if (now != last_poll){
+			last_poll = now;
+			poll_round = LIST_LEN(&poll_list);
+		}
+
+		co_t *co = take_next(&poll_round);
+		if (co == NULL){
+			u_int ticks = idle_ticks();
+			if (ticks > 0)
+				block(&host_wait, ticks);
+			continue;
+		}
+		exit_critical();
+
+		int stat = co->func(co);
+
+		enter_critical();
+		switch (stat){
+		case co_yielded:
+			list_insert_end(&ready_list, &co->node);
+			break;
+
+		case co_sleeping:
+			timer_wheel_insert(&sleepers, &co->node);
+			++sleeper_nums;
+			break;
+
+		case co_polling:
+			list_insert_end(&poll_list, &co->node);
+			break;
+
+		case co_waiting:
+			list_insert_end(co->wait_on, &co->wait_node);
+			if (co->timed){
+				timer_wheel_insert(&sleepers, &co->node);
+				++sleeper_nums;
+			}
+			break;
+
+		default:
+			co->started = false;
+			--co_nums;
+			break;
+		}
+	}
+}
+
+
+// the host task is created when the first coroutine is initialized
+static void service_init(void){
+	list_init(&ready_list);
+	list_init(&poll_list);
+	list_init(&host_wait);
+	timer_wheel_init(&sleepers, os_get_tick());
+	host = task_init(host_task, "coroutine", NULL, CFG_COROUTINE_PRIO,
+	                 host_stack, CFG_COROUTINE_STACK_SIZE);
+}
+
+
+/*
+@ brief: Initialize a coroutine, it does not run until co_start().
+*/
+void co_init(co_t *co, co_func_t func, void *para){
+	enter_critical();
+	if (host == NULL)
+		service_init();
+	exit_critical();
+
+	LIST_NODE_INIT(&co->node);
+	LIST_NODE_INIT(&co->wait_node);
+	co->wait_on = NULL;
+	co->func = func;
+	co->para = para;
+	co->lc = 0;
+	co->timed = false;
+	co->started = false;
+}
+
+
+static void make_ready(co_t *co){
+	list_insert_end(&ready_list, &co->node);
+	if (LIST_NOT_EMPTY(&host_wait))
+		task_ready_isr(host);
+}
+
+
+/*
+@ brief: Run the coroutine from its beginning.
+@ note: Do nothing if it is already running. Never blocks, can be called in isr.
+*/
+void co_start(co_t *co){
+	enter_critical();
+	if (!co->started){
+		co->started = true;
+		co->lc = 0;
+		++co_nums;
+		make_ready(co);
+	}
+	exit_critical();
+}
+
+
+/*
+@ brief: Resume a sleeping or waiting coroutine now, a wait checks its condition again.
+@ note: Do nothing if the coroutine is ready or running. Never blocks, can be called in isr.
+*/
+void co_wake(co_t *co){
+	enter_critical();
+	list_t *from = co->node.leader;
+	bool parked = (from != NULL && from != &ready_list);    // sleeping or polling
+	bool waiting = !IS_ORPHAN_NODE(&co->wait_node);
+
+	if (parked){
+		if (from != &poll_list)
+			--sleeper_nums;    // on the wheel
+		list_remove(&co->node);
+	}
+	if (waiting)
+		list_remove(&co->wait_node);
+
+	if (parked || waiting)
+		make_ready(co);
+	exit_critical();
+}
+
+
+/*
+@ brief: Make the first coroutine waiting on a kernel object ready, it checks
+         its condition again and waits once more if another taker was faster.
+@ note: Called by the give paths of the object, in critical or isr.
+*/
+void co_notify(list_t *waiters){
+	if (LIST_IS_EMPTY(waiters))
+		return;
+
+	co_t *co = WAIT_NODE_TO_CO(FIRST_OF(*waiters));
+	list_remove(&co->wait_node);
+	if (!IS_ORPHAN_NODE(&co->node)){
+		list_remove(&co->node);    // the deadline of a timed wait
+		--sleeper_nums;
+	}
+	make_ready(co);
+}
+
+
+/*
+@ brief: Get the number of coroutines started and not ended.
+*/
+int co_count(void){
+	return co_nums;
+}
+
+
+void co_set_deadline(co_t *co, u_int ticks){
+	co->timed = (ticks != FOREVER);
+	co->node.value = os_get_tick() + ticks;
+}
+
+
+bool co_timed_out(co_t *co){
+	return co->timed && (int)(os_get_tick() - co->node.value) >= 0;
+}
+
+#endif  // CFG_USE_COROUTINE
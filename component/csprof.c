@@ -0,0 +1,87 @@
+/*
+ * Kora rtos
+ * Copyright (c) 2024 biaboi
+ *
+ * This file is part of this project and is licensed under the MIT License.
+ * See the LICENSE file in the project root for full license information.
+ */
+
+
+#include "Kora.h"
+#include "csprof.h"
+
+#include <string.h>
+
+/**
+ * @file    csprof.c
+ * @brief   Critical section duration profiler.
+ *
+ * The port calls csprof_enter() when lock_nesting goes from 0 to 1 and
+ * csprof_exit() right before it goes back to 0, both with interrupts disabled,
+ * so the statistics need no extra protection. The measured time is the
+ * interrupt latency added by the kernel, use the caller address of the
+ * longest section to find it in the map file.
+ *
+ * A section that sleeps on purpose, like the tickless idle, calls
+ * csprof_discard() so its sleep is not taken for interrupt latency.
+ */
+
+#if CFG_USE_CSPROF
+
+u_int port_timestamp(void);
+
+static csprof_stat_t  stat;
+static u_int          enter_stamp;
+static u_int          enter_caller;
+static bool           discarded;
+
+
+void csprof_enter(u_int caller){
+	enter_caller = caller;
+	enter_stamp = port_timestamp();
+}
+
+
+void csprof_discard(void){
+	discarded = true;
+}
+
+
+void csprof_exit(void){
+	if (discarded){
+		discarded = false;
+		return;
+	}
+
+	u_int cycles = port_timestamp() - enter_stamp;
+
+	int bin = 0;
+	for (u_int v = cycles >> 5; v != 0 && bin < CSPROF_HIST_BINS - 1; v >>= 1)
+		++bin;
+
+	stat.hist[bin] += 1;
+	stat.count += 1;
+	if (cycles > stat.max_cycles){
+		stat.max_cycles = cycles;
+		stat.max_caller = enter_caller;
+	}
+}
+
+
+/*
+@ brief: Copy the statistics to out.
+*/
+void csprof_get(csprof_stat_t *out){
+	enter_critical();
+	*out = stat;
+	exit_critical();
+}
+
+
+void csprof_reset(void){
+	enter_critical();
+	memset(&stat, 0, sizeof(stat));
+	exit_critical();
+}
+
+#endif  // CFG_USE_CSPROF
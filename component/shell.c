@@ -10,6 +10,7 @@
 #include "KoraConfig.h"
 #include "log.h"
 #include "shell.h"
+#include "csprof.h"
 
 #include <stdio.h>
 #include <string.h>
@@ -23,10 +24,15 @@
 	   -s        : Suspend a task
 	   -r        : Resume a task
 	   -i <name> : Display information for the specified task
+	   -p        : Display statistics of periodic tasks
+	   -w [reset]: Display weights and shares of tasks in weighted levels (CFG_USE_WEIGHTED_RR)
 
 	2. heap      - Display current heap usage and state
 
-	3. log       - Logging control commands
+	3. crit      - Display critical section statistics (CFG_USE_CSPROF)
+	   reset     : Clear the statistics
+
+	4. log       - Logging control commands
 	   <name> <op>
 	     op:
 	       on/off               : Enable or disable the specified module
@@ -56,6 +62,7 @@ typedef struct {
 int __task(int argc, char **agrv);
 int __heap(int argc, char **agrv);
 int __log(int argc, char **agrv);
+int __crit(int argc, char **argv);
 int __var(int argc, char **argv);
 
 static shell_var_t var_table[MAX_NUM_OF_EXPORT_VAR];
@@ -66,8 +73,9 @@ static command_t commands[10] = {
 	{"heap", __heap},  
 	{"log", __log},
 	{"var", __var},
+	{"crit", __crit},
 };
-static u_char commands_size = 4;
+static u_char commands_size = 5;
 
 
 void shell_export_var(char* name, void* addr, var_type_t type) {
@@ -314,35 +322,109 @@ static char *stat_to_str[5] = {
 
 
 static int set_task_table_title(void){
-	return sprintf(out_buf, "%-10s  %6s  %8s   %6s   %9s \r\n", 
-				"name", "prio", "state", "min_stack", "cpu_usage" );
+	return sprintf(out_buf, "%-10s  %6s  %8s   %6s   %9s  %6s  %6s \r\n", 
+				"name", "prio", "state", "min_stack", "cpu_usage", "stack", "advise" );
+}
+
+
+/*
+@ brief: Get the minimum free stack of the task seen so far.
+@ retv: 0 if the stack usage is not tracked.
+*/
+static u_int min_free_stack(task_handle tsk){
+#if CFG_USE_STACK_PAINT
+	return task_stack_watermark(tsk);
+#elif CFG_USE_TCB_DEBUG
+	return tsk->min_stack;
+#else
+	return 0;
+#endif
+}
+
+
+/*
+@ brief: Recommend a stack size for the task, the used part plus 25% margin.
+*/
+static u_int advise_stack_size(task_handle tsk, u_int min_free){
+	u_int size = task_stack_size(tsk);
+#if CFG_USE_STACK_PAINT || CFG_USE_TCB_DEBUG
+	u_int used = min_free < size ? size - min_free : 0;   // not measured yet
+	u_int advise = (used + used / 4 + 7) & ~7u;
+	return advise < CFG_MIN_STACK_SIZE ? CFG_MIN_STACK_SIZE : advise;
+#else
+	return size;    // nothing measured, keep it
+#endif
 }
 
 
 /*
 @ brief: Write task's infomations to buffer and send: 
-         name, priority, state, min_stack, occupied_tick
+         name, priority, state, min_stack, occupied_tick, stack size, advised stack size
 */
 void output_task_info(task_handle tsk, void *nothing){
-	int usage = os_get_tick() / 100;
-	usage = tsk->occupied_tick / usage;
+	u_int min_free = min_free_stack(tsk);
+
+#if CFG_USE_CYCLE_ACCOUNTING
+	// permille of cycles since start
+	cycle_t total = os_get_total_cycles() / 1000;
+	int usage = total ? task_run_cycles(tsk) / total : 0;
+#else
+	int usage = os_get_tick() / 1000;
+	usage = usage ? tsk->occupied_tick / usage : 0;
+#endif
 
-	int size = sprintf(out_buf, "%-10s  %6d  %8s   %4d   %9d "NL,  
-				tsk->name, 
+	int size = sprintf(out_buf, "%-10s  %6d  %8s   %4d   %7d.%d   %6d  %6d "NL,  
+				task_name(tsk), 
 				tsk->priority, 
 				stat_to_str[(int)(tsk->state)], 
-				tsk->min_stack,
-				usage );
+				min_free,
+				usage / 10, usage % 10,
+				task_stack_size(tsk),
+				advise_stack_size(tsk, min_free) );
+	output(out_buf, size);
+}
+
+
+void output_periodic_info(task_handle tsk, void *nothing){
+	periodic_t *pd = tsk->periodic;
+	if (pd == NULL)
+		return;
+
+	int size = sprintf(out_buf, "%-10s  %6u  %8u  %8u  %6u  %6u/%u"NL,
+				task_name(tsk),
+				pd->period,
+				pd->jobs,
+				pd->overruns,
+				pd->missed,
+				pd->max_jitter,
+				pd->jobs ? pd->total_jitter / pd->jobs : 0 );
+	output(out_buf, size);
+}
+
+
+#if CFG_USE_WEIGHTED_RR
+void output_share_info(task_handle tsk, void *nothing){
+	if (!os_is_weighted_level(tsk->priority))
+		return;
+
+	u_int share = task_share(tsk);
+	int size = sprintf(out_buf, "%-10s  %6d  %6d  %6u.%u"NL,
+				task_name(tsk),
+				tsk->priority,
+				tsk->weight,
+				share / 10, share % 10 );
 	output(out_buf, size);
 }
 
+#endif
+
 
 int __task(int argc, char **argv) {
-	char buf[CFG_TASK_NAME_LEN];
+	char buf[TASK_NAME_SIZE];
 	int size;   // output data size
 
 	// output all task's infomation
-	if (strncmp(argv[0], "-a", CFG_TASK_NAME_LEN) == 0){
+	if (strncmp(argv[0], "-a", TASK_NAME_SIZE) == 0){
 		size = set_task_table_title();
 		output(out_buf, size);
 
@@ -352,7 +434,7 @@ int __task(int argc, char **argv) {
 	}
 
 	// suspend a task
-	else if (strncmp(argv[1], "-s", CFG_TASK_NAME_LEN) == 0){
+	else if (strncmp(argv[1], "-s", TASK_NAME_SIZE) == 0){
 		name_combine(argc-1, argv+1, buf);
 		task_handle the_task = task_find(buf);
 		if (the_task == NULL){
@@ -365,7 +447,7 @@ int __task(int argc, char **argv) {
 
 
 	// resume a task
-	else if (strncmp(argv[0], "-r", CFG_TASK_NAME_LEN) == 0){
+	else if (strncmp(argv[0], "-r", TASK_NAME_SIZE) == 0){
 		name_combine(argc-1, argv+1, buf);
 		task_handle the_task = task_find(buf);
 		if (the_task == NULL){
@@ -380,7 +462,7 @@ int __task(int argc, char **argv) {
 
 
 	// output information about the specified task
-	else if (strncmp(argv[0], "-i", CFG_TASK_NAME_LEN) == 0) {
+	else if (strncmp(argv[0], "-i", TASK_NAME_SIZE) == 0) {
 		name_combine(argc-1, argv+1, buf);
 		task_handle the_task = task_find(buf);
 		if (the_task == NULL){
@@ -396,6 +478,37 @@ int __task(int argc, char **argv) {
 		}
 	}
 
+	// output statistics of periodic tasks
+	else if (strncmp(argv[0], "-p", TASK_NAME_SIZE) == 0) {
+		size = sprintf(out_buf, "%-10s  %6s  %8s  %8s  %6s  %10s"NL,
+					"name", "period", "jobs", "overrun", "missed", "jitter max/avg");
+		output(out_buf, size);
+
+		foreach_task(output_periodic_info, NULL);
+		output(NL, sizeof(NL));
+		return RET_SUCCESS;
+	}
+
+#if CFG_USE_WEIGHTED_RR
+	// output realized shares of weighted levels
+	else if (strncmp(argv[0], "-w", TASK_NAME_SIZE) == 0) {
+		if (argc > 1 && strcmp(argv[1], "reset") == 0){
+			for (u_int prio = 0; prio < CFG_MAX_PRIOS; ++prio){
+				if (os_is_weighted_level(prio))
+					os_reset_share(prio);
+			}
+			return RET_SUCCESS;
+		}
+
+		size = sprintf(out_buf, "%-10s  %6s  %6s  %8s"NL, "name", "prio", "weight", "share%");
+		output(out_buf, size);
+
+		foreach_task(output_share_info, NULL);
+		output(NL, sizeof(NL));
+		return RET_SUCCESS;
+	}
+#endif
+
 	else {
 		output("unknown parameter"NL, 20);
 		return RET_FAILED;
@@ -446,6 +559,43 @@ int __heap(int argc, char **agrv){
 }
 
 
+/*************************** build-in command: crit ***************************/
+int __crit(int argc, char **argv){
+#if CFG_USE_CSPROF
+	csprof_stat_t info;
+	int size;
+
+	if (argc > 0 && strcmp(argv[0], "reset") == 0){
+		csprof_reset();
+		return RET_SUCCESS;
+	}
+
+	csprof_get(&info);
+	size = sprintf(out_buf, "count %u  max %u cycles (%u us)  at 0x%08X"NL,
+				info.count,
+				info.max_cycles,
+				info.max_cycles / (CFG_CPU_CLOCK_HZ / 1000000),
+				info.max_caller);
+	output(out_buf, size);
+
+	for (int i = 0; i < CSPROF_HIST_BINS; ++i){
+		if (info.hist[i] == 0)
+			continue;
+		size = sprintf(out_buf, "  %s%6u cycles  %u"NL,
+					i == CSPROF_HIST_BINS - 1 ? ">=" : "< ",
+					i == CSPROF_HIST_BINS - 1 ? 16u << i : 32u << i,
+					info.hist[i]);
+		output(out_buf, size);
+	}
+	return RET_SUCCESS;
+
+#else
+	return RET_FAILED;
+
+#endif
+}
+
+
 /**************************** build-in command: log ****************************/
 
 extern const char *level_str[5];
@@ -0,0 +1,153 @@
+/*
+ * Kora rtos
+ * Copyright (c) 2024 biaboi
+ *
+ * This file is part of this project and is licensed under the MIT License.
+ * See the LICENSE file in the project root for full license information.
+ */
+
+
+#include "trace.h"
+
+#include <string.h>
+
+/**
+ * @file    trace.c
+ * @brief   Binary kernel event trace recorder.
+ *
+ * Kernel writes compact records (timestamp, event, running task, object) into a RAM ring.
+ * A slot is reserved by an atomic add on the write index, so recording never disables
+ * interrupts and can be called from any context, the cost is tens of cycles per event.
+ *
+ * Tasks are identified by a one byte trace id assigned at creation, the create record
+ * maps the id (arg) to the tcb address (obj) and is followed by records carrying
+ * the task name, 4 chars each.
+ *
+ * Dump format: trace_header_t followed by 'count' records, oldest first,
+ * tools/trace_decode.py converts it to a timeline.
+ */
+
+#if CFG_USE_TRACE
+
+#if (CFG_TRACE_BUF_RECORDS & (CFG_TRACE_BUF_RECORDS - 1)) != 0
+	#error "CFG_TRACE_BUF_RECORDS must be a power of 2"
+#endif
+
+#define TRACE_MAGIC     0x4352544Bu    // "KTRC"
+#define TRACE_VERSION   1
+
+typedef struct {
+	u_int    magic;
+	u_short  version;
+	u_short  record_size;
+	u_int    count;
+	u_int    dropped;         // records overwritten or discarded
+	u_int    stamp_hz;
+} trace_header_t;
+
+
+extern tcb_t * volatile current_tcb;
+u_int port_timestamp(void);
+u_int port_atomic_add(volatile u_int *addr, u_int val);
+
+static trace_record_t   trace_buf[CFG_TRACE_BUF_RECORDS];
+static volatile u_int   trace_head = 0;     // total records reserved
+static volatile u_int   trace_mask = 0;     // 0 means stopped
+static trace_mode_t     trace_mode = trace_overwrite;
+static u_char           next_id = 0;
+
+
+/*
+@ brief: Clear the buffer and start recording the events in event_mask.
+*/
+void trace_start(trace_mode_t mode, u_int event_mask){
+	trace_mask = 0;
+	trace_mode = mode;
+	trace_head = 0;
+	trace_mask = event_mask;
+}
+
+
+void trace_stop(void){
+	trace_mask = 0;
+}
+
+
+void trace_set_mask(u_int event_mask){
+	trace_mask = event_mask;
+}
+
+
+static void put_record(u_char event, u_int obj, u_short arg){
+	if ((trace_mask & (1u << event)) == 0)
+		return;
+
+	u_int idx = port_atomic_add(&trace_head, 1);
+	if (idx >= CFG_TRACE_BUF_RECORDS && trace_mode == trace_stop_when_full)
+		return;
+
+	trace_record_t *rec = trace_buf + (idx & (CFG_TRACE_BUF_RECORDS - 1));
+	rec->stamp = port_timestamp();
+	rec->event = event;
+	rec->task = current_tcb ? current_tcb->trace_id : 0xFF;
+	rec->arg = arg;
+	rec->obj = obj;
+}
+
+
+void trace_record(u_char event, u_int obj){
+	put_record(event, obj, 0);
+}
+
+
+/*
+@ brief: Give the task a trace id and record its creation and name.
+*/
+void trace_task_register(task_handle tsk){
+	tsk->trace_id = next_id;
+	next_id = (next_id == 0xFE) ? 0 : next_id + 1;
+
+	put_record(trace_task_create, (u_int)tsk, tsk->trace_id);
+#if CFG_TASK_NAME_LEN > 0
+	for (int i = 0; i < CFG_TASK_NAME_LEN && tsk->name[i]; i += 4){
+		u_int chars = 0;
+		strncpy((char*)&chars, tsk->name + i, 4);
+		trace_record(trace_task_name, chars);
+	}
+#endif
+}
+
+
+/*
+@ brief: Stop recording and send the header and records through out().
+@ retv: Number of records sent.
+*/
+int trace_dump(transfer_t out){
+	u_int mask = trace_mask;
+	trace_mask = 0;
+
+	u_int head = trace_head;
+	u_int count = head < CFG_TRACE_BUF_RECORDS ? head : CFG_TRACE_BUF_RECORDS;
+	u_int first = (trace_mode == trace_overwrite) ? head - count : 0;
+
+	trace_header_t header = {
+		TRACE_MAGIC, TRACE_VERSION, sizeof(trace_record_t),
+		count, head - count, CFG_CPU_CLOCK_HZ
+	};
+	out((char*)&header, sizeof(header));
+
+	// the ring may wrap, send it in two parts
+	u_int start = first & (CFG_TRACE_BUF_RECORDS - 1);
+	u_int part = CFG_TRACE_BUF_RECORDS - start;
+	if (part > count)
+		part = count;
+
+	out((char*)(trace_buf + start), part * sizeof(trace_record_t));
+	if (count > part)
+		out((char*)trace_buf, (count - part) * sizeof(trace_record_t));
+
+	trace_mask = mask;
+	return count;
+}
+
+#endif  // CFG_USE_TRACE
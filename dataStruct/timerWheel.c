@@ -0,0 +1,187 @@
+#include "timerWheel.h"
+#include <limits.h>
+
+
+/*
+ * @file    timerWheel.c
+ *
+ * A hashed timer wheel used to replace sorted list where a lot of nodes wait for
+ * a tick. Insert and remove cost O(1), advance costs O(expired) per tick.
+ *
+ * Layout:
+ * near[] holds nodes expire within TW_SLOTS ticks, one slot per tick.
+ * far[] holds nodes expire within TW_SPAN ticks, one slot per TW_SLOTS ticks,
+ * a far slot is cascaded into near[] when the near wheel wraps.
+ * overflow holds the others and is scanned once every TW_SPAN ticks.
+ *
+ * When the tick of a near slot arrives, all nodes of the slot are moved to the
+ * expired list, the user takes them away from there.
+ */
+
+/*
+@ brief: Mount the node on the right level according to its expire tick.
+@ note: Only used by cascading, the node must not expire before tw->now.
+*/
+static int place(timer_wheel *tw, list_node_t *node){
+	u_int delta = node->value - tw->now;
+
+	if (delta < TW_SLOTS)
+		return list_insert_end(tw->near + (node->value & TW_MASK), node);
+
+	if (delta < TW_SPAN)
+		return list_insert_end(tw->far + ((node->value >> CFG_TIMER_WHEEL_BITS) & TW_MASK), node);
+
+	return list_insert_end(&tw->overflow, node);
+}
+
+
+void timer_wheel_init(timer_wheel *tw, u_int now){
+	for (int i = 0; i < TW_SLOTS; ++i){
+		list_init(tw->near + i);
+		list_init(tw->far + i);
+	}
+	list_init(&tw->overflow);
+	list_init(&tw->expired);
+	tw->now = now;
+}
+
+
+/*
+@ brief: Mount a node whose value is the absolute expire tick.
+@ note: The expire tick must be within INT_MAX ticks from now,
+        node that already expired goes to the expired list directly.
+@ retv: RET_FAILED -> node is mounted on other list
+*/
+int timer_wheel_insert(timer_wheel *tw, list_node_t *node){
+	if ((int)(node->value - tw->now) <= 0)
+		return list_insert_end(&tw->expired, node);
+
+	return place(tw, node);
+}
+
+
+static void cascade(timer_wheel *tw, list_t *lst){
+	while (LIST_NOT_EMPTY(lst)){
+		list_node_t *node = FIRST_OF(*lst);
+		list_remove(node);
+		place(tw, node);
+	}
+}
+
+
+static void cascade_overflow(timer_wheel *tw){
+	list_node_t *iter = FIRST_OF(tw->overflow);
+
+	while (iter != &tw->overflow.dmy){
+		list_node_t *next = iter->next;
+		if (iter->value - tw->now < TW_SPAN){
+			list_remove(iter);
+			place(tw, iter);
+		}
+		iter = next;
+	}
+}
+
+
+// nothing is mounted on any level
+static bool wheel_empty(timer_wheel *tw){
+	if (LIST_NOT_EMPTY(&tw->overflow))
+		return false;
+
+	for (int i = 0; i < TW_SLOTS; ++i){
+		if (LIST_NOT_EMPTY(tw->near + i) || LIST_NOT_EMPTY(tw->far + i))
+			return false;
+	}
+	return true;
+}
+
+
+/*
+@ brief: Process every tick up to 'now', due nodes are moved to the expired list.
+@ note: An empty wheel jumps to now at once, so a long idle costs O(TW_SLOTS)
+        instead of one step per tick.
+*/
+void timer_wheel_advance(timer_wheel *tw, u_int now){
+	if (now - tw->now > TW_SLOTS && wheel_empty(tw)){
+		tw->now = now;
+		return;
+	}
+
+	while (tw->now != now){
+		u_int idx = (++tw->now) & TW_MASK;
+
+		if (idx == 0){
+			u_int far_idx = (tw->now >> CFG_TIMER_WHEEL_BITS) & TW_MASK;
+			if (far_idx == 0 && LIST_NOT_EMPTY(&tw->overflow))
+				cascade_overflow(tw);
+			cascade(tw, tw->far + far_idx);
+		}
+
+		list_t *slot = tw->near + idx;
+		while (LIST_NOT_EMPTY(slot)){
+			list_node_t *node = FIRST_OF(*slot);
+			list_remove(node);
+			list_insert_end(&tw->expired, node);
+		}
+	}
+}
+
+
+// keep the earlier of the found tick and the values of lst
+static bool earliest_of(list_t *lst, bool found, u_int *tick){
+	for (list_node_t *it = FIRST_OF(*lst); it != &lst->dmy; it = it->next){
+		if (!found || (int)(it->value - *tick) < 0){
+			*tick = it->value;
+			found = true;
+		}
+	}
+	return found;
+}
+
+
+/*
+@ brief: Get how many ticks after now the first mounted node expires.
+@ param: now -> current tick, the wheel may not have been advanced to it yet.
+@ retv: UINT_MAX if nothing is mounted.
+@ note: Near slots before the next cascade point are searched first, they hold 
+        one tick each. After it, the later near slots are merged with the first
+        non-empty far slot, and the overflow list is only walked when nothing is
+        found before the next overflow cascade, no overflow node is earlier.
+*/
+u_int timer_wheel_next_expire(timer_wheel *tw, u_int now){
+	if (LIST_NOT_EMPTY(&tw->expired))
+		return 0;
+
+	u_int tick = 0;
+	bool found = false;
+	u_int limit = TW_SLOTS - (tw->now & TW_MASK);
+
+	for (u_int i = 1; i < TW_SLOTS && !found; ++i){
+		if (LIST_NOT_EMPTY(tw->near + ((tw->now + i) & TW_MASK))){
+			tick = tw->now + i;
+			found = true;
+		}
+	}
+
+	if (!found || tick - tw->now >= limit){
+		// far slots after the current one, the current slot holds the next round
+		u_int far_idx = tw->now >> CFG_TIMER_WHEEL_BITS;
+		for (u_int k = 1; k <= TW_SLOTS; ++k){
+			list_t *slot = tw->far + ((far_idx + k) & TW_MASK);
+			if (LIST_NOT_EMPTY(slot)){
+				found = earliest_of(slot, found, &tick);
+				break;
+			}
+		}
+
+		u_int overflow_from = (tw->now & ~(TW_SPAN - 1)) + TW_SPAN;
+		if (!found || (int)(tick - overflow_from) >= 0)
+			found = earliest_of(&tw->overflow, found, &tick);
+	}
+
+	if (!found)
+		return UINT_MAX;
+
+	// the ticks the wheel lags behind are already gone
+	return (int)(tick - now) > 0 ? tick - now : 0;
+}
@@ -7,6 +7,7 @@
 #include "list.h"
 #include "queue.h"
 #include "byteBuffer.h"
+#include "timerWheel.h"
 #include <limits.h>
 
 #define KORA_VERSION    "0.85"
@@ -29,31 +30,113 @@
 
 typedef void (*transfer_t)(char *, int);
 
+typedef unsigned long long tick_t;
+typedef unsigned long long cycle_t;
+
 typedef enum {
 	running, ready, sleeping, blocking, suspend
 } task_stat;
 
+typedef enum {
+	notify_idle, notify_waiting, notify_pending
+} notify_stat;
+
+
+// Release time and statistics of a periodic task, see task_set_periodic().
+typedef struct {
+	u_int   period;
+	u_int   release;          // release tick of the current job
+	u_int   jobs;             // jobs finished
+	u_int   overruns;         // jobs finished after the next release
+	u_int   missed;           // releases skipped because of overrun
+	u_int   max_jitter;       // ticks between release and the job starts
+	u_int   total_jitter;
+} periodic_t;
 
+
+/*
+	Fields are grouped by how often they are touched: everything PendSV, 
+	schedule() and the tick handler use comes first in about 40 bytes, ipc 
+	fields follow, and the debug and statistics fields are at the end.
+	priority and state are narrowed to a byte, CFG_MAX_PRIOS is at most 256.
+	The name and the debug fields can be compiled out, see CFG_TASK_NAME_LEN 
+	and CFG_USE_TCB_DEBUG.
+*/
 typedef struct __tcb {
-	u_char         *top_of_stack;
+	/* hot */
+	u_char         *top_of_stack;     // must be the first member, PendSV saves sp here
+	list_node_t     state_node;       // state_node will be only mounted on ready_list or sleep_list
+	u_char          priority;
+	u_char          state;            // task_stat
+#if CFG_USE_PREEMPT_THRESHOLD
+	u_char          threshold;        // only tasks of higher priority than this can preempt it
+#endif
+#if CFG_USE_TRACE
+	u_char          trace_id;         // identify the task in trace records
+#endif
+#if CFG_USE_WEIGHTED_RR
+	u_char          weight;           // quantum is weight * CFG_WEIGHT_QUANTUM
+#endif
+#if CFG_USE_CPU_BUDGET
+	u_char          base_prio;        // priority without the budget, the one changed by task_modify_priority()
+	u_char          inherited;        // base_prio is lent by a mutex waiter, kept when demoted
+#endif
+	u_short         time_slice;       // round-robin quantum in ticks
+	u_short         slice_left;
+#if CFG_USE_TCB_DEBUG
 	u_int           magic;            // used for check if tcb is accidentally overwritten 
+#endif
+	void           *mpu_cfg;          // stack guard region, RBAR value written at switch
 	u_int           occupied_tick;    // used for roughly calculate the CPU usage
+#if CFG_USE_WEIGHTED_RR
+	u_int           share_ticks;      // ticks run in a weighted level since os_reset_share()
+#endif
+#if CFG_USE_EDF
+	u_int           deadline;         // absolute deadline tick, only used in EDF band
+#endif
+#if CFG_USE_CPU_BUDGET
+	struct cpu_budget *budget;        // ticks the task runs are charged here, NULL for no limit
+	list_node_t     budget_node;      // mounted on the throttled list of the budget when used up
+#endif
+#if CFG_USE_CYCLE_ACCOUNTING
+	cycle_t         run_cycles;       // cpu time in cycles, exact CPU usage
+#endif
+
+	/* ipc */
+	list_node_t     event_node;       
+	u_int           evt_flags;        // used in event group
+#if CFG_TASK_NOTIFY_SLOTS > 0
+	u_int           notify_value[CFG_TASK_NOTIFY_SLOTS];
+	u_char          notify_state[CFG_TASK_NOTIFY_SLOTS];
+#endif
+
+	/* cold */
 	u_char         *start_addr;
-	u_int           priority;
+#if CFG_TASK_NAME_LEN > 0
 	char            name[CFG_TASK_NAME_LEN];
-	u_int           min_stack;        // store the minimum remaining stack size
-	task_stat       state;
-	void           *mpu_cfg;
+#endif
+#if CFG_USE_TASK_NAME_HASH
+	u_int           name_hash;        // key of the name index used by task_find()
+#endif
+	u_int           slice_expired;    // times the task was rotated out for using up its quantum
+#if CFG_USE_TCB_DEBUG
+	u_int           min_stack;        // store the minimum remaining stack size, see task_stack_watermark()
 	void           *user_data;
-	u_int           evt_flags;        // used in event group
-	list_node_t     state_node;       // state_node will be only mounted on ready_list or sleep_list
-	list_node_t     event_node;       
+#endif
+	periodic_t     *periodic;         // NULL if the task is not periodic
 	list_node_t     link_node;        // once the task is created, it is mounted to the all_tasks list 
 } tcb_t;
 
 
 typedef tcb_t* task_handle;
 
+// size of a buffer that holds a task name typed by the user
+#if CFG_TASK_NAME_LEN > 0
+	#define TASK_NAME_SIZE    CFG_TASK_NAME_LEN
+#else
+	#define TASK_NAME_SIZE    16
+#endif
+
 
 #define PRIORITY_LOWEST     (u_int)(CFG_MAX_PRIOS-1)
 #define PRIORITY_HIGHEST    (u_int)1
@@ -62,6 +145,16 @@ typedef tcb_t* task_handle;
 // Used as a parameter of foreach_task() to process tasks.
 typedef void (*task_process_t)(task_handle, void *);
 
+// Statistics of waking sleeping tasks in tick handler, see os_get_wake_stat().
+typedef struct {
+	u_int   last_woken;       // tasks woken in the last tick
+	u_int   max_woken;        // most tasks woken in one tick
+	u_int   total_woken;
+	u_int   deferred;         // ticks that hit CFG_MAX_WAKE_PER_TICK and left tasks to next tick
+	u_int   max_late;         // ticks between deadline and wake up, worst case
+	u_int   total_late;
+} wake_stat_t;
+
 task_handle task_init(vfunc code, const char *name, void *para, u_int prio, u_char *stk, int size);
 task_handle task_create(vfunc code, const char *name, void *para, u_int prio, int size);
 task_handle qcreate(vfunc code, int priority, int size);
@@ -72,11 +165,37 @@ int task_modify_priority(task_handle tsk, int new);
 void task_ready(task_handle tsk);
 void task_ready_isr(task_handle tsk);
 void sleep(u_int xtick);
+void sleep_until(u_int *last_wake, u_int period);
+void task_set_periodic(periodic_t *pd, u_int period);
+void task_wait_next_period(void);
 void block(list_t *blklst, u_int wait_ticks);
 void block_isr(task_handle tsk, list_t *blklst, u_int wait_ticks);
 void task_suspend(task_handle tsk);
 void task_suspend_isr(task_handle tsk);
 
+#if CFG_USE_EDF
+void task_set_deadline(task_handle tsk, u_int rel_ticks);
+#endif
+
+#if CFG_USE_PREEMPT_THRESHOLD
+u_int task_set_preempt_threshold(task_handle tsk, u_int threshold);
+#endif
+
+void task_set_time_slice(task_handle tsk, u_int ticks);
+u_int task_slice_expired_count(task_handle tsk);
+
+#if CFG_USE_WEIGHTED_RR
+void os_set_weighted_level(u_int prio, bool weighted);
+bool os_is_weighted_level(u_int prio);
+void task_set_weight(task_handle tsk, u_int weight);
+u_int task_share(task_handle tsk);
+void os_reset_share(u_int prio);
+#endif
+
+#if CFG_USE_STACK_PAINT
+u_int task_stack_watermark(task_handle tsk);
+#endif
+u_int task_stack_size(task_handle tsk);
 task_stat task_state(task_handle tsk);
 u_int task_left_sleep_tick(task_handle tsk);
 char* task_name(task_handle tsk);
@@ -91,8 +210,16 @@ bool is_scheduler_running(void);
 task_handle task_self(void);
 task_handle os_get_running_task(void);
 int os_get_tick(void);
+tick_t os_get_tick64(void);
 int os_get_cpu_utilization(void);
 int os_get_task_num(void);
+void os_isr_enter(void);
+void os_isr_exit(void);
+#if CFG_USE_CYCLE_ACCOUNTING
+cycle_t task_run_cycles(task_handle tsk);
+cycle_t os_get_total_cycles(void);
+#endif
+wake_stat_t* os_get_wake_stat(void);
 
 void Kora_start(void);
 
@@ -107,6 +234,9 @@ typedef struct counting_semaphore {
 	volatile int   count;
 	int            size;
 	list_t         block_list;
+#if CFG_USE_COROUTINE
+	list_t         co_list;         // coroutines waiting in CO_SEM_WAIT
+#endif
 } cntsem;
 
 typedef cntsem* sem_t;
@@ -145,6 +275,9 @@ typedef struct message_queue {
 	queue      que;
 	list_t     wb_list;				// write block list
 	list_t     rb_list;				// read block list
+#if CFG_USE_COROUTINE
+	list_t     co_list;             // coroutines waiting in CO_MSGQ_FRONT
+#endif
 } msgque;
 
 typedef msgque* msgq_t;
@@ -197,6 +330,9 @@ typedef struct {
 	byte_buffer   bbf;
 	list_t        rb_list;  // read_block_list
 	list_t        wb_list;  // write_block_list
+#if CFG_USE_COROUTINE
+	list_t        co_list;  // coroutines waiting in CO_STREAMQ_FRONT
+#endif
 } streamq;
 
 typedef streamq* streamq_t;
@@ -212,6 +348,83 @@ int streamq_front(streamq_t sq, void *output, u_int wait_ticks);
 int streamq_front_pointer(streamq_t sq, void **pointer, u_short *outlen, u_int wait_ticks);
 void streamq_pop(streamq_t sq);
 
+/******************************** software timer **********************************/
+
+typedef struct software_timer {
+	list_node_t    node;        // value: absolute expire tick
+	u_int          period;
+	bool           periodic;
+	vfunc          callback;    // called in timer task with para
+	void          *para;
+} swtimer;
+
+typedef swtimer* swtimer_t;
+
+void swtimer_init(swtimer_t tmr, vfunc callback, void *para, u_int period, bool periodic);
+swtimer_t swtimer_create(vfunc callback, void *para, u_int period, bool periodic);
+int swtimer_delete(swtimer_t tmr);
+
+void swtimer_start(swtimer_t tmr);
+void swtimer_stop(swtimer_t tmr);
+void swtimer_reset(swtimer_t tmr);
+void swtimer_change_period(swtimer_t tmr, u_int period);
+bool swtimer_is_active(swtimer_t tmr);
+
+// start and stop only take a short critical section and never block
+#define swtimer_start_isr(tmr)   swtimer_start(tmr)
+#define swtimer_stop_isr(tmr)    swtimer_stop(tmr)
+
+/******************************** cpu budget **********************************/
+
+typedef enum {
+	budget_demote = 0,        // run at demote_prio until replenished
+	budget_suspend            // suspend until replenished
+} budget_action_t;
+
+// Ticks a task or a group of tasks may run per period, see budget_init().
+typedef struct cpu_budget {
+	swtimer        timer;       // replenishes the budget every period
+	u_int          capacity;    // ticks per period
+	u_int          used;        // ticks run in this period, counted on past capacity
+	u_int          overruns;    // periods in which the budget was used up
+	u_char         action;      // budget_action_t
+	u_char         demote_prio;
+	list_t         throttled;   // members demoted or suspended until the next period
+} cpu_budget_t;
+
+#define IS_THROTTLED(tsk)   (!IS_ORPHAN_NODE(&(tsk)->budget_node))
+
+void budget_init(cpu_budget_t *b, u_int capacity, u_int period, budget_action_t action, u_int demote_prio);
+void task_set_budget(task_handle tsk, cpu_budget_t *b);
+
+/**************************** task notification ******************************/
+
+typedef enum {
+	notify_set_bits,        // value |= bits
+	notify_increment,       // value += 1, the value is ignored
+	notify_overwrite,       // value = value
+	notify_no_overwrite     // value = value, fail if the last notification is not taken
+} notify_action_t;
+
+#if CFG_TASK_NOTIFY_SLOTS > 0
+int task_notify(task_handle tsk, u_int slot, u_int value, notify_action_t action);
+int task_notify_isr(task_handle tsk, u_int slot, u_int value, notify_action_t action);
+int task_notify_wait(u_int slot, u_int clr_on_entry, u_int clr_on_exit, u_int *value, u_int wait_ticks);
+#endif
+
+/******************************** pend call **********************************/
+
+typedef void (*pend_func_t)(void *arg1, u_int arg2);
+
+typedef struct {
+	u_int   pended;           // calls accepted
+	u_int   dropped;          // calls rejected because the queue was full
+	u_int   max_pending;      // most calls waiting at the same time
+} pend_call_stat_t;
+
+int os_pend_call(pend_func_t func, void *arg1, u_int arg2);
+pend_call_stat_t* os_get_pend_call_stat(void);
+
 /******************************** kernel hooks **********************************/
 
 typedef struct {
@@ -224,7 +437,7 @@ typedef enum {
 	hook_task_delete,            // para: the deleted task's handle
 	hook_idle,                   // para: NULL
 	hook_stack_overf_isr,        // para: the task's handle which stack overflow
-	hook_systick_isr,            // para: &os_tick_count
+	hook_systick_isr,            // para: &os_tick_count (tick_t*)
 
 	kernel_hook_nums
 } kernel_hooks_t;
@@ -4,14 +4,57 @@
 
 #define CFG_CPU_CLOCK_HZ            64000000
 #define CFG_TICK_PER_SEC            1000
-#define CFG_TASK_NAME_LEN           16
+#define CFG_TASK_NAME_LEN           16      // 0 compiles task names out, then task_find() always fails
+#define CFG_USE_TCB_DEBUG           1       // tcb magic check, min_stack and user_data, 0 saves 12 bytes per task
+#define CFG_USE_TASK_NAME_HASH      0       // index task names by hash for task_find()
+#define CFG_TASK_HASH_SLOTS         32      // 4 bytes each, power of 2, larger than the number of tasks
 #define CFG_MAX_PRIOS               16
 #define CFG_MIN_STACK_SIZE          400
+#define CFG_USE_STACK_PAINT         1       // paint stacks to find the high watermark, check a canary at switch
+#define CFG_USE_MPU_STACK_GUARD     0       // fault at once when a task overflows its stack, needs MPU
+#define CFG_MPU_GUARD_REGION        7       // MPU region number used by the stack guard
+#define CFG_DEFAULT_TIME_SLICE      1       // default round-robin quantum in ticks
+#define CFG_USE_WEIGHTED_RR         0       // deficit round-robin by weight in chosen levels, see task_set_weight()
+#define CFG_WEIGHT_QUANTUM          1       // ticks of quantum per unit of weight
+#define CFG_TASK_NOTIFY_SLOTS       1       // notification words per task, 0 disables task notification
+#define CFG_USE_PREEMPT_THRESHOLD   0       // per task preemption threshold, see task_set_preempt_threshold()
+
+#define CFG_USE_BASEPRI_CRITICAL    0       // critical sections raise BASEPRI instead of disabling all interrupts
+#define CFG_MAX_SYSCALL_PRIO        5       // interrupts with priority value lower than this are never masked
+                                            // and must not call any kernel api
+
+#define CFG_USE_CYCLE_ACCOUNTING    0       // charge cpu cycles to tasks at every switch
+#define CFG_CYCLE_ACCOUNT_ISR       0       // do not charge interrupt time, needs os_isr_enter/exit()
+
+#define CFG_USE_TIMER_WHEEL         1       // sleeping tasks are kept in a timer wheel instead of sorted list
+#define CFG_TIMER_WHEEL_BITS        5       // each level of the wheel has (1 << bits) slots
+#define CFG_MAX_WAKE_PER_TICK       0       // bound of tasks woken in one tick, 0 means no limit
+
+#define CFG_USE_TICKLESS_IDLE       0       // stop the tick in idle task when nothing to do
+#define CFG_TICKLESS_MIN_IDLE_TICKS 2       // do not stop the tick for a shorter idle period
+#define CFG_TICKLESS_RELOAD_CORRECTION  45  // cpu cycles lost while reprogramming SysTick
+
+#define CFG_USE_SOFT_TIMER          0       // software timers, callbacks run in a timer task
+#define CFG_SOFT_TIMER_PRIO         1
+#define CFG_SOFT_TIMER_STACK_SIZE   512
+#define CFG_USE_CPU_BUDGET          0       // limit the ticks a task or group runs per period, see budget_init(), needs soft timer
+
+#define CFG_USE_PEND_CALL           0       // os_pend_call(), run deferred isr work in a task
+#define CFG_PEND_CALL_QUEUE_LEN     16      // must be a power of 2
+#define CFG_PEND_CALL_PRIO          1
+#define CFG_PEND_CALL_STACK_SIZE    512
+
+#define CFG_USE_EDF                 0       // schedule the tasks of one priority level by earliest deadline
+#define CFG_EDF_PRIO                8       // the priority level used as EDF band
 
 
 #define CFG_ALLOW_DYNAMIC_ALLOC     1
 #define CFG_HEAP_SIZE               (u_int)(20 * 1024)
 
+#define CFG_USE_STACK_POOL          0       // task_create() takes stacks from fixed size pools cut from heap
+#define CFG_STACK_POOL_SIZES        {512, 1024}   // block size of each class, ascending, multiple of 8
+#define CFG_STACK_POOL_COUNTS       {4, 2}        // number of blocks of each class
+
 #define CFG_KORA_ASSERT             1
 
 #define CFG_USING_LOG_SYSTEM        1
@@ -20,6 +63,18 @@
 #define CFG_USE_ALLOC_HOOKS         1
 #define CFG_USE_IPC_HOOKS           1
 
+#define CFG_USE_BASIC_TASK          0       // run-to-completion tasks sharing a stack per priority, see btask.h
+#define CFG_BASIC_TASK_LEVELS       4       // levels created by btask_level_init()
+
+#define CFG_USE_COROUTINE           0       // stackless coroutines run by one host task, see coroutine.h
+#define CFG_COROUTINE_PRIO          2
+#define CFG_COROUTINE_STACK_SIZE    1024
+
+#define CFG_USE_TRACE               0       // record kernel events into a RAM ring, see trace.h
+#define CFG_TRACE_BUF_RECORDS       256     // 12 bytes per record, must be a power of 2
+
+#define CFG_USE_CSPROF              0       // measure critical sections, see csprof.h
+
 #define kn_print(...) printf(__VA_ARGS__)
 
 #include "port.h"
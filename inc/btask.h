@@ -0,0 +1,30 @@
+#ifndef _BTASK_H
+#define _BTASK_H
+
+#include "Kora.h"
+
+/*
+	Run-to-completion (basic) tasks. A basic task is only a handler, it is 
+	activated by events, runs to the end and never blocks. All basic tasks of 
+	one priority share a level task and its stack, level tasks are ordinary 
+	tasks, so they are scheduled by the priority bitmap like any other.
+*/
+
+typedef struct basic_task {
+	list_node_t    node;        // mounted on the activated list of its level
+	vfunc          handler;     // called with para, must not block
+	void          *para;
+	u_char         prio;
+	u_short        pending;     // activations not run yet
+	u_int          runs;
+} btask;
+
+typedef btask* btask_t;
+
+task_handle btask_level_init(u_int prio, u_char *stack, int size);
+task_handle btask_level_create(u_int prio, int size);
+
+void btask_init(btask_t bt, vfunc handler, void *para, u_int prio);
+int btask_activate(btask_t bt);
+
+#endif
@@ -0,0 +1,121 @@
+#ifndef _COROUTINE_H
+#define _COROUTINE_H
+
+#include "Kora.h"
+
+/*
+	Stackless coroutines (protothread style). A coroutine is a function that
+	is called again and again by one host task, the CO_ macros record where
+	it stopped and jump back there on the next call, so it owns no stack and
+	costs one co_t (48 bytes on 32-bit cpu).
+
+	Limits of the trick:
+	  - local variables are lost at every wait, keep the state in para or in
+	    a struct that embeds the co_t.
+	  - CO_ macros can only be used in the coroutine function itself, and
+	    not inside a switch statement of it.
+	  - a coroutine must never call a blocking api with wait ticks, that
+	    would block every coroutine, use the CO_ waits instead.
+
+	int worker(co_t *co){
+		struct ctx *c = co->para;
+		CO_BEGIN(co);
+		while (1){
+			CO_SEM_WAIT(co, &c->sem, 100, c->ret);
+			...
+			CO_SLEEP(co, 10);
+		}
+		CO_END(co);
+	}
+*/
+
+typedef struct coroutine co_t;
+typedef int (*co_func_t)(co_t *co);
+
+enum co_stat {
+	co_ended = 0,      // returned by CO_END / CO_EXIT, the coroutine is detached
+	co_yielded,        // run again after the other ready coroutines
+	co_sleeping,       // node.value is the tick to wake up
+	co_polling,        // condition is checked again every tick, node.value is the deadline
+	co_waiting         // run again when wait_on is notified, or at node.value if timed
+};
+
+struct coroutine {
+	list_node_t    node;        // mounted on the ready list, the poll list or the sleep wheel
+	list_node_t    wait_node;   // mounted on wait_on while waiting on a kernel object
+	list_t        *wait_on;     // co_list of the kernel object, set by the CO_ waits
+	co_func_t      func;
+	void          *para;
+	u_short        lc;          // where to resume, 0 is the beginning
+	u_char         timed;       // the poll has a deadline
+	u_char         started;     // started and not ended
+};
+
+void co_init(co_t *co, co_func_t func, void *para);
+void co_start(co_t *co);
+void co_wake(co_t *co);
+int  co_count(void);
+
+// used by the macros below
+void co_set_deadline(co_t *co, u_int ticks);
+bool co_timed_out(co_t *co);
+
+// used by the ipc give paths, in critical or isr
+void co_notify(list_t *waiters);
+
+#if CFG_USE_COROUTINE
+	#define CO_NOTIFY(waiters)    co_notify(waiters)
+#else
+	#define CO_NOTIFY(waiters)    ((void)0)
+#endif
+
+
+#define CO_BEGIN(co)        switch ((co)->lc) { case 0:
+
+#define CO_END(co)          } (co)->lc = 0; return co_ended
+
+#define CO_EXIT(co)         do { (co)->lc = 0; return co_ended; } while (0)
+
+#define CO_YIELD(co)        do { (co)->lc = __LINE__; return co_yielded; \
+                                 case __LINE__:; } while (0)
+
+#define CO_SLEEP(co, ticks) do { (co)->node.value = os_get_tick() + (ticks); \
+                                 (co)->lc = __LINE__; return co_sleeping; \
+                                 case __LINE__:; } while (0)
+
+// wait until cond is true, cond is evaluated once every tick
+#define CO_AWAIT(co, cond)  do { (co)->timed = false; (co)->lc = __LINE__; \
+                                 case __LINE__: if (!(cond)) return co_polling; } while (0)
+
+// wait until cond is true or ticks passed, ok is set to the last cond result
+#define CO_AWAIT_TIMEOUT(co, cond, ticks, ok) \
+                            do { co_set_deadline((co), (ticks)); (co)->lc = __LINE__; \
+                                 case __LINE__: if (!((ok) = (cond)) && !co_timed_out(co)) \
+                                     return co_polling; } while (0)
+
+// wait until cond is true or ticks passed, cond is only checked again when the 
+// kernel object notifies lst, so the wait costs nothing per tick
+#define CO_WAIT_ON(co, lst, cond, ticks, ok) \
+                            do { co_set_deadline((co), (ticks)); (co)->wait_on = (lst); (co)->lc = __LINE__; \
+                                 case __LINE__: if (!((ok) = (cond)) && !co_timed_out(co)) \
+                                     return co_waiting; } while (0)
+
+// ret: RET_SUCCESS(took the semaphore) / RET_FAILED(timeout)
+#define CO_SEM_WAIT(co, s, ticks, ret) \
+                            do { bool _ok; \
+                                 CO_WAIT_ON(co, &(s)->co_list, sem_wait((s), 0) >= 0, ticks, _ok); \
+                                 (ret) = _ok ? RET_SUCCESS : RET_FAILED; } while (0)
+
+// ret: RET_SUCCESS(buf holds the front item, pop it by msgq_pop()) / RET_FAILED(timeout)
+#define CO_MSGQ_FRONT(co, mq, buf, ticks, ret) \
+                            do { bool _ok; \
+                                 CO_WAIT_ON(co, &(mq)->co_list, msgq_front((mq), (buf), 0) == RET_SUCCESS, ticks, _ok); \
+                                 (ret) = _ok ? RET_SUCCESS : RET_FAILED; } while (0)
+
+// ret: size of the data read out / RET_FAILED(timeout)
+#define CO_STREAMQ_FRONT(co, sq, output, ticks, ret) \
+                            do { bool _ok; \
+                                 CO_WAIT_ON(co, &(sq)->co_list, ((ret) = streamq_front((sq), (output), 0)) != RET_FAILED, ticks, _ok); \
+                                 (void)_ok; } while (0)
+
+#endif
@@ -0,0 +1,43 @@
+#ifndef _CSPROF_H
+#define _CSPROF_H
+
+#include "KoraConfig.h"
+
+/*
+	Critical section profiler, measures the time between the outermost
+	enter_critical() and exit_critical() in cpu cycles.
+
+	Histogram bin i counts the sections of [2^(i+4), 2^(i+5)) cycles,
+	bin 0 also counts shorter ones and the last bin counts longer ones.
+*/
+
+#define CSPROF_HIST_BINS    16
+
+typedef struct {
+	u_int   count;                      // sections measured
+	u_int   max_cycles;                 // the longest section
+	u_int   max_caller;                 // return address of the enter_critical() that opened it
+	u_int   hist[CSPROF_HIST_BINS];
+} csprof_stat_t;
+
+void csprof_get(csprof_stat_t *out);
+void csprof_reset(void);
+
+// called by the port with interrupts disabled
+void csprof_enter(u_int caller);
+void csprof_exit(void);
+
+// called in critical, the current section is not measured
+void csprof_discard(void);
+
+#if CFG_USE_CSPROF
+	#define CSPROF_ENTER(caller)   csprof_enter(caller)
+	#define CSPROF_EXIT()          csprof_exit()
+	#define CSPROF_DISCARD()       csprof_discard()
+#else
+	#define CSPROF_ENTER(caller)   ((void)0)
+	#define CSPROF_EXIT()          ((void)0)
+	#define CSPROF_DISCARD()       ((void)0)
+#endif
+
+#endif
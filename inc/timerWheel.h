@@ -0,0 +1,34 @@
+#ifndef _TIMER_WHEEL_H
+#define _TIMER_WHEEL_H
+
+#include "KoraConfig.h"
+#include "list.h"
+
+/*
+	Two level hashed timer wheel with an overflow list.
+
+	The value of each mounted node is its absolute expire tick, all compares
+	are done by (int)(a - b), so the tick counter is allowed to wrap around.
+	A node can be removed at any time by list_remove().
+*/
+
+#define TW_SLOTS     (1u << CFG_TIMER_WHEEL_BITS)
+#define TW_MASK      (TW_SLOTS - 1)
+#define TW_SPAN      (TW_SLOTS << CFG_TIMER_WHEEL_BITS)   // ticks covered by both levels
+
+typedef struct {
+	u_int     now;                 // the last tick that has been processed
+	list_t    near[TW_SLOTS];      // level 0, one tick per slot
+	list_t    far[TW_SLOTS];       // level 1, TW_SLOTS ticks per slot
+	list_t    overflow;            // expire tick beyond TW_SPAN
+	list_t    expired;             // nodes that are due, taken away by the user
+} timer_wheel;
+
+#define TIMER_WHEEL_EXPIRED(tw)   (&(tw)->expired)
+
+void timer_wheel_init(timer_wheel *tw, u_int now);
+int timer_wheel_insert(timer_wheel *tw, list_node_t *node);
+void timer_wheel_advance(timer_wheel *tw, u_int now);
+u_int timer_wheel_next_expire(timer_wheel *tw, u_int now);
+
+#endif
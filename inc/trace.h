@@ -0,0 +1,71 @@
+#ifndef _TRACE_H
+#define _TRACE_H
+
+#include "Kora.h"
+
+/*
+	Kernel event trace recorder, records are written to a RAM ring and
+	dumped with trace_dump(), use tools/trace_decode.py to read the dump.
+*/
+
+typedef enum {
+	trace_task_create = 0,   // obj: tcb
+	trace_task_name,         // obj: 4 chars of the task name, emitted after create
+	trace_task_delete,       // obj: tcb
+	trace_task_switch,       // obj: tcb of the previous task
+	trace_task_ready,        // obj: tcb
+	trace_task_block,        // obj: block list of the ipc
+	trace_task_sleep,        // obj: ticks
+	trace_task_suspend,      // obj: tcb
+
+	trace_sem_wait,          // obj: ipc pointer
+	trace_sem_signal,
+	trace_mutex_lock,
+	trace_mutex_unlock,
+	trace_msgq_push,
+	trace_msgq_front,
+	trace_evt_wait,
+	trace_evt_set,
+	trace_streamq_push,
+	trace_streamq_front,
+
+	trace_isr_enter,         // obj: interrupt nesting
+	trace_isr_exit,
+	trace_malloc,            // obj: address
+	trace_free,              // obj: address
+
+	trace_event_nums
+} trace_event_t;
+
+typedef enum {
+	trace_overwrite = 0,     // ring, keep the latest records
+	trace_stop_when_full     // keep the first records
+} trace_mode_t;
+
+// 12 bytes per record
+typedef struct {
+	u_int    stamp;          // port_timestamp()
+	u_char   event;
+	u_char   task;           // trace id of the running task, 0xFF in startup
+	u_short  arg;            // trace id of the new task in create record
+	u_int    obj;
+} trace_record_t;
+
+#define TRACE_ALL_EVENTS   ((1u << trace_event_nums) - 1)
+
+void trace_start(trace_mode_t mode, u_int event_mask);
+void trace_stop(void);
+void trace_set_mask(u_int event_mask);
+void trace_record(u_char event, u_int obj);
+void trace_task_register(task_handle tsk);
+int  trace_dump(transfer_t out);
+
+#if CFG_USE_TRACE
+	#define TRACE(event, obj)       trace_record((event), (u_int)(obj))
+	#define TRACE_TASK_CREATE(tsk)  trace_task_register(tsk)
+#else
+	#define TRACE(event, obj)       ((void)0)
+	#define TRACE_TASK_CREATE(tsk)  ((void)0)
+#endif
+
+#endif
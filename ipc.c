@@ -8,6 +8,8 @@
 
 #include "KoraConfig.h"
 #include "Kora.h"
+#include "trace.h"
+#include "coroutine.h"
 #include <string.h>
 
 
@@ -26,6 +28,7 @@
  * - Message Queue
  * - Event Group
  * - Stream Queue
+ * - Task Notification
  */
 
 #define EVENT_NODE_TO_TCB(pnode) ((tcb_t*)( (u_int)(pnode) - offsetof(tcb_t, event_node)) )
@@ -62,6 +65,9 @@ void sem_init(cntsem *s, int max_cnt, int init_cnt){
 	s->size = max_cnt;
 	s->count = init_cnt;
 	list_init(&s->block_list);
+#if CFG_USE_COROUTINE
+	list_init(&s->co_list);
+#endif
 }
 
 
@@ -79,7 +85,11 @@ int sem_delete(cntsem *s){
 	if (!is_heap_addr(s))
 		return RET_FAILED;
 
-	if (LIST_IS_EMPTY(&s->block_list)){
+	if (LIST_IS_EMPTY(&s->block_list)
+#if CFG_USE_COROUTINE
+		&& LIST_IS_EMPTY(&s->co_list)
+#endif
+		){
 		queue_free(s);
 		return RET_SUCCESS;
 	}
@@ -94,6 +104,7 @@ int sem_delete(cntsem *s){
         it will exit immediately without triggering an schedule
 */
 int sem_wait(cntsem *s, u_int wait_ticks){
+	TRACE(trace_sem_wait, s);
 	enter_critical();
 
 	while (s->count <= 0){
@@ -145,6 +156,7 @@ int sem_peek(cntsem *s, u_int wait_ticks){
         Other -> semaphore current count
 */
 int sem_signal(cntsem *s){
+	TRACE(trace_sem_signal, s);
 	os_assert(lock_nesting == 0);
 
 	enter_critical();
@@ -153,6 +165,7 @@ int sem_signal(cntsem *s){
 		return RET_FAILED;
 	}
 	s->count += 1;
+	CO_NOTIFY(&s->co_list);
 	wakeup(&s->block_list);
 	exit_critical();
 	return s->count;
@@ -160,10 +173,12 @@ int sem_signal(cntsem *s){
 
 
 int sem_signal_isr(cntsem *s){
+	TRACE(trace_sem_signal, s);
 	if (s->count >= s->size){
 		return RET_FAILED;
 	}
 	s->count += 1;
+	CO_NOTIFY(&s->co_list);
 	wakeup_isr(&s->block_list);
 	return s->count;
 }
@@ -207,6 +222,7 @@ int mutex_delete(mutex *mtx){
 @ brief: Get a mutex.
 */
 void mutex_lock(mutex *mtx){
+	TRACE(trace_mutex_lock, mtx);
 	os_assert(lock_nesting == 0);
 
 	enter_critical();
@@ -223,8 +239,12 @@ void mutex_lock(mutex *mtx){
 		int cur_prio = current_tcb->priority;
 
 		// priority promote
-		if (owner_prio > cur_prio)
+		if (owner_prio > cur_prio){
+#if CFG_USE_CPU_BUDGET
+			owner->inherited = true;    // kept even if the owner is demoted
+#endif
 			mtx->bkp_prio = task_modify_priority(owner, cur_prio);
+		}
 
 		block(&mtx->block_list, FOREVER);
 	}
@@ -235,6 +255,7 @@ void mutex_lock(mutex *mtx){
 @ brief: Release a mutex.
 */
 void mutex_unlock(mutex *mtx){
+	TRACE(trace_mutex_unlock, mtx);
 	os_assert(lock_nesting == 0);
 
 	enter_critical();
@@ -243,6 +264,9 @@ void mutex_unlock(mutex *mtx){
 
 	// recover owner_task's original priority
 	if (mtx->bkp_prio != 0){
+#if CFG_USE_CPU_BUDGET
+		owner->inherited = false;    // a demoted owner goes back to demote_prio
+#endif
 		task_modify_priority(owner, mtx->bkp_prio);
 		mtx->bkp_prio = 0;
 	}
@@ -260,6 +284,9 @@ void msgq_init(msgque *mq, int nitems, int size){
 
 	list_init(&mq->wb_list);
 	list_init(&mq->rb_list);
+#if CFG_USE_COROUTINE
+	list_init(&mq->co_list);
+#endif
 }
 
 
@@ -278,6 +305,9 @@ msgque* msgq_create(int nitems, int size){
 int msgq_delete(msgque *mq){
 	int stat = ((queue*)mq)->len | mq->wb_list.list_len 
 					   		     | mq->rb_list.list_len;
+#if CFG_USE_COROUTINE
+	stat |= mq->co_list.list_len;
+#endif
 	if (stat != 0)
 		return RET_FAILED;
 	if (is_heap_addr(mq))
@@ -292,13 +322,15 @@ int msgq_delete(msgque *mq){
 @ retv: RET_SUCCESS / RET_FAILED
 */
 int msgq_push(msgque *mq, void *item, u_int wait_ticks){
+	TRACE(trace_msgq_push, mq);
 	os_assert(lock_nesting == 0);
 
 	enter_critical();
 	while (1){
 		if (!MSGQUE_FULL(mq)){
 			queue_push((queue*)mq, item);
-			wakeup(&mq->rb_list);
+			CO_NOTIFY(&mq->co_list);
+	wakeup(&mq->rb_list);
 			exit_critical();
 			return RET_SUCCESS;
 		}
@@ -344,9 +376,11 @@ int msgq_waitfor_push(msgque *mq, u_int wait_ticks){
          beginning of the queue will be overwritten.
 */
 void msgq_overwrite(msgque *mq, void *item){
+	TRACE(trace_msgq_push, mq);
 	enter_critical();
 
 	queue_push((queue*)mq, item);
+	CO_NOTIFY(&mq->co_list);
 	wakeup(&mq->rb_list);
 
 	exit_critical();
@@ -354,7 +388,9 @@ void msgq_overwrite(msgque *mq, void *item){
 
 
 void msgq_overwrite_isr(msgque *mq, void *item){
+	TRACE(trace_msgq_push, mq);
 	queue_push((queue*)mq, item);
+	CO_NOTIFY(&mq->co_list);
 	wakeup_isr(&mq->rb_list);
 }
 
@@ -364,6 +400,7 @@ void msgq_overwrite_isr(msgque *mq, void *item){
 @ note: Only read item, must use msgque_pop() to pop item.
 */ 
 int msgq_front(msgque *mq, void *buf, u_int wait_ticks){
+	TRACE(trace_msgq_front, mq);
 	enter_critical();
 	while (1){
 		if (!QUEUE_IS_EMPTY((queue*)mq)){
@@ -462,6 +499,7 @@ static bool is_bits_satisfy(event_t grp, u_int evt_val){
          opt-> the condition under which the event occurs is bit and/or
 */
 int evt_wait(event_t grp, evt_bits_t bits, bool clr, int opt, u_int wait_ticks){
+	TRACE(trace_evt_wait, grp);
 	os_assert(bits < 0x01000000);
 
 	enter_critical();
@@ -491,6 +529,7 @@ int evt_wait(event_t grp, evt_bits_t bits, bool clr, int opt, u_int wait_ticks){
 @ brief: Set event group bits.
 */
 void evt_set(event_t grp, evt_bits_t bits){
+	TRACE(trace_evt_set, grp);
 	enter_critical();
 
 	grp->evt_bits |= bits;
@@ -509,6 +548,7 @@ void evt_set(event_t grp, evt_bits_t bits){
 
 
 void evt_set_isr(event_t grp, evt_bits_t bits){
+	TRACE(trace_evt_set, grp);
 	grp->evt_bits |= bits;
 	list_node_t *iter = &grp->block_list.dmy;
 
@@ -555,6 +595,9 @@ void streamq_init(streamq_t sq, void *buf, int buf_size){
 	byte_buffer_init(&sq->bbf, buf, buf_size);
 	list_init(&sq->wb_list);
 	list_init(&sq->rb_list);
+#if CFG_USE_COROUTINE
+	list_init(&sq->co_list);
+#endif
 }
 
 
@@ -579,6 +622,10 @@ streamq_t streamq_create(int buf_size){
 int streamq_delete(streamq_t sq){
 	if (LIST_NOT_EMPTY(&sq->wb_list) || LIST_NOT_EMPTY(&sq->rb_list))
 		return RET_FAILED;
+#if CFG_USE_COROUTINE
+	if (LIST_NOT_EMPTY(&sq->co_list))
+		return RET_FAILED;
+#endif
 
 	if (!is_heap_addr(sq))
 		return RET_FAILED;
@@ -595,13 +642,15 @@ int streamq_delete(streamq_t sq){
 @ retv:  RET_SUCCESS / RET_FAILED.
 */
 int streamq_push(streamq_t sq, void *data, u_short size, u_int wait_ticks){
+	TRACE(trace_streamq_push, sq);
 	os_assert(lock_nesting == 0);
 
 	enter_critical();
 	while (1){
 		int ret = byte_buffer_push(&sq->bbf, data, size);
 		if (ret != RET_FAILED){
-			wakeup(&sq->rb_list);
+			CO_NOTIFY(&sq->co_list);
+	wakeup(&sq->rb_list);
 			exit_critical();
 			return RET_SUCCESS;
 		}
@@ -621,10 +670,12 @@ int streamq_push(streamq_t sq, void *data, u_short size, u_int wait_ticks){
 @ retv:  RET_SUCCESS / RET_FAILED.
 */
 int streamq_push_isr(streamq_t sq, void *data, u_short size){
+	TRACE(trace_streamq_push, sq);
 	int ret = byte_buffer_push(&sq->bbf, data, size);
 	if (ret == RET_FAILED){
 		return RET_FAILED;
 	}
+	CO_NOTIFY(&sq->co_list);
 	wakeup_isr(&sq->rb_list);
 	return RET_SUCCESS;
 }
@@ -636,6 +687,7 @@ int streamq_push_isr(streamq_t sq, void *data, u_short size){
          Other -> size of read out data
 */
 int streamq_front(streamq_t sq, void *output, u_int wait_ticks){
+	TRACE(trace_streamq_front, sq);
 	os_assert(lock_nesting == 0);
 
 	enter_critical();
@@ -665,6 +717,7 @@ int streamq_front(streamq_t sq, void *output, u_int wait_ticks){
 @ retv:  RET_SUCCESS / RET_FAILED.
 */
 int streamq_front_pointer(streamq_t sq, void **pointer, u_short *outlen, u_int wait_ticks){
+	TRACE(trace_streamq_front, sq);
 	enter_critical();
 	while (1){
 		int ret = byte_buffer_front_pointer(&sq->bbf, pointer, outlen);
@@ -695,3 +748,118 @@ void streamq_pop(streamq_t sq){
 	exit_critical();
 }
 
+
+/***************************** task notification *******************************/
+/*
+	Each task owns CFG_TASK_NOTIFY_SLOTS notification words, a notifier writes
+	the word of a known task directly and wakes it if it is waiting on that slot.
+	The waiting task is not mounted on any block list.
+*/
+
+#if CFG_TASK_NOTIFY_SLOTS > 0
+
+// update the word and mark it pending, must be protected by the caller
+static int notify_update(task_handle tsk, u_int slot, u_int value, notify_action_t action){
+	u_int *word = tsk->notify_value + slot;
+
+	switch (action){
+	case notify_set_bits:
+		*word |= value;
+		break;
+
+	case notify_increment:
+		*word += 1;
+		break;
+
+	case notify_overwrite:
+		*word = value;
+		break;
+
+	case notify_no_overwrite:
+		if (tsk->notify_state[slot] == notify_pending)
+			return RET_FAILED;
+		*word = value;
+		break;
+	}
+
+	return RET_SUCCESS;
+}
+
+
+/*
+@ brief: Send a notification to the slot of the task.
+@ retv: RET_SUCCESS / RET_FAILED(notify_no_overwrite and the last one is not taken)
+*/
+int task_notify(task_handle tsk, u_int slot, u_int value, notify_action_t action){
+	os_assert(slot < CFG_TASK_NOTIFY_SLOTS);
+	enter_critical();
+
+	if (notify_update(tsk, slot, value, action) == RET_FAILED){
+		exit_critical();
+		return RET_FAILED;
+	}
+
+	u_char last = tsk->notify_state[slot];
+	tsk->notify_state[slot] = notify_pending;
+
+	if (last == notify_waiting && tsk->state == blocking)
+		task_ready(tsk);
+	else
+		exit_critical();
+
+	return RET_SUCCESS;
+}
+
+
+int task_notify_isr(task_handle tsk, u_int slot, u_int value, notify_action_t action){
+	os_assert(slot < CFG_TASK_NOTIFY_SLOTS);
+
+	if (notify_update(tsk, slot, value, action) == RET_FAILED)
+		return RET_FAILED;
+
+	u_char last = tsk->notify_state[slot];
+	tsk->notify_state[slot] = notify_pending;
+
+	if (last == notify_waiting && tsk->state == blocking)
+		task_ready_isr(tsk);
+
+	return RET_SUCCESS;
+}
+
+
+/*
+@ brief: Wait for a notification on the slot of the running task.
+@ param: clr_on_entry -> bits cleared before waiting if no notification is pending.
+         clr_on_exit -> bits cleared after the notification is taken.
+         value -> receive the value before clr_on_exit applied, can be NULL.
+@ retv: RET_SUCCESS / RET_FAILED(timeout)
+*/
+int task_notify_wait(u_int slot, u_int clr_on_entry, u_int clr_on_exit, u_int *value, u_int wait_ticks){
+	os_assert(slot < CFG_TASK_NOTIFY_SLOTS);
+	os_assert(lock_nesting == 0);
+
+	enter_critical();
+	task_handle self = current_tcb;
+
+	if (self->notify_state[slot] != notify_pending){
+		self->notify_value[slot] &= ~clr_on_entry;
+		if (wait_ticks != 0){
+			self->notify_state[slot] = notify_waiting;
+			block(NULL, wait_ticks);
+		}
+	}
+
+	int ret = RET_FAILED;
+	if (self->notify_state[slot] == notify_pending){
+		if (value != NULL)
+			*value = self->notify_value[slot];
+		self->notify_value[slot] &= ~clr_on_exit;
+		ret = RET_SUCCESS;
+	}
+	self->notify_state[slot] = notify_idle;
+
+	exit_critical();
+	return ret;
+}
+
+#endif  // CFG_TASK_NOTIFY_SLOTS
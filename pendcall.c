@@ -0,0 +1,134 @@
+/*
+ * Kora rtos
+ * Copyright (c) 2024 biaboi
+ *
+ * This file is part of this project and is licensed under the MIT License.
+ * See the LICENSE file in the project root for full license information.
+ */
+
+#include "KoraConfig.h"
+#include "Kora.h"
+
+
+/**
+ * @file pendcall.c
+ * @brief Deferred function calls from interrupts.
+ *
+ * An isr hands the heavy part of its work to os_pend_call(), the call is
+ * stored in a ring and executed later by the pend call task in FIFO order,
+ * so interrupt sources share one task and stack for their bottom halves.
+ *
+ * Producers reserve a slot by CAS on the head index and publish it by
+ * writing the slot sequence, so nested isrs never disable interrupts to
+ * enqueue. There is only one consumer, the pend call task.
+ */
+
+#if CFG_USE_PEND_CALL
+
+#if (CFG_PEND_CALL_QUEUE_LEN & (CFG_PEND_CALL_QUEUE_LEN - 1)) != 0
+	#error "CFG_PEND_CALL_QUEUE_LEN must be a power of 2"
+#endif
+
+#define SLOT_MASK   (CFG_PEND_CALL_QUEUE_LEN - 1)
+
+typedef struct {
+	volatile u_int   seq;        // index + 1 when the slot is published
+	pend_func_t      func;
+	void            *arg1;
+	u_int            arg2;
+} pend_slot_t;
+
+bool port_atomic_cas(volatile u_int *addr, u_int expect, u_int val);
+
+static pend_slot_t       ring[CFG_PEND_CALL_QUEUE_LEN];
+static volatile u_int    head = 0;         // next index to reserve
+static volatile u_int    tail = 0;         // next index to execute
+static pend_call_stat_t  stat;
+
+static list_t            service_wait;     // the pend call task blocks here when the ring is empty
+static task_handle       service = NULL;
+static u_char            service_stack[CFG_PEND_CALL_STACK_SIZE];
+
+
+static inline bool slot_published(u_int idx){
+	return ring[idx & SLOT_MASK].seq == idx + 1;
+}
+
+
+static void pend_call_task(void *nothing){
+	enter_critical();
+	while (1){
+		if (!slot_published(tail)){
+			block(&service_wait, FOREVER);
+			continue;
+		}
+		exit_critical();
+
+		while (slot_published(tail)){
+			pend_slot_t *slot = ring + (tail & SLOT_MASK);
+			pend_func_t func = slot->func;
+			void *arg1 = slot->arg1;
+			u_int arg2 = slot->arg2;
+
+			// the slot can be reused by producers after tail moves
+			++tail;
+			func(arg1, arg2);
+		}
+
+		enter_critical();
+	}
+}
+
+
+/*
+@ brief: Create the pend call task, called by Kora_start().
+*/
+void pend_call_init(void){
+	list_init(&service_wait);
+	service = task_init(pend_call_task, "pendcall", NULL, CFG_PEND_CALL_PRIO,
+	                    service_stack, CFG_PEND_CALL_STACK_SIZE);
+}
+
+
+/*
+@ brief: Let the pend call task execute func(arg1, arg2) as soon as possible.
+@ note: Never blocks, mainly used in isr, it's also fine to be called by tasks.
+@ retv: RET_SUCCESS / RET_FAILED(the queue is full, the call is dropped)
+*/
+int os_pend_call(pend_func_t func, void *arg1, u_int arg2){
+	u_int idx;
+
+	do {
+		idx = head;
+		if (idx - tail >= CFG_PEND_CALL_QUEUE_LEN){
+			stat.dropped += 1;
+			return RET_FAILED;
+		}
+	} while (!port_atomic_cas(&head, idx, idx + 1));
+
+	pend_slot_t *slot = ring + (idx & SLOT_MASK);
+	slot->func = func;
+	slot->arg1 = arg1;
+	slot->arg2 = arg2;
+	slot->seq = idx + 1;
+
+	// statistics are best effort, an update may be lost when isrs nest here
+	stat.pended += 1;
+	if (idx + 1 - tail > stat.max_pending)
+		stat.max_pending = idx + 1 - tail;
+
+	if (LIST_NOT_EMPTY(&service_wait)){
+		enter_critical();
+		if (LIST_NOT_EMPTY(&service_wait))
+			task_ready_isr(service);
+		exit_critical();
+	}
+	return RET_SUCCESS;
+}
+
+
+pend_call_stat_t* os_get_pend_call_stat(void){
+	return &stat;
+}
+
+#endif  // CFG_USE_PEND_CALL
@@ -1,5 +1,6 @@
 #include "main.h"
 #include "KoraConfig.h"
+#include "csprof.h"
 
 #define EXCRET_MSP_HANDLE		0xFFFFFFF1
 #define EXCRET_MSP_THREAD		0xFFFFFFF9
@@ -9,6 +10,29 @@ typedef unsigned int u_int;
 
 extern u_int lock_nesting;
 
+#if CFG_USE_BASEPRI_CRITICAL
+// priority values are kept in the high bits of the 8-bit priority field
+#define BASEPRI_SYSCALL    (CFG_MAX_SYSCALL_PRIO << (8 - __NVIC_PRIO_BITS))
+
+// mask the interrupts whose priority value >= CFG_MAX_SYSCALL_PRIO,
+// the higher ones are never delayed by the kernel
+void enter_critical(void){
+	__set_BASEPRI(BASEPRI_SYSCALL);
+	__DSB();
+	__ISB();
+	if (lock_nesting++ == 0)
+		CSPROF_ENTER(__return_address());
+}
+
+
+void exit_critical(void){
+	if (--lock_nesting == 0){
+		CSPROF_EXIT();
+		__set_BASEPRI(0);
+	}
+}
+
+#else
 // disable all interrpution except NMI and HardFault
 void enter_critical(void){
 	__asm {
@@ -16,18 +40,22 @@ void enter_critical(void){
 		dsb
 		isb
 	}
-	lock_nesting += 1;
+	if (lock_nesting++ == 0)
+		CSPROF_ENTER(__return_address());
 }
 
 
 void exit_critical(void){
 	if (--lock_nesting == 0){
+		CSPROF_EXIT();
 		__asm {
 			cpsie i;
 		}
 	}
 }
 
+#endif
+
 
 void task_self_delete(void);
 void port_rt_stack_init(vfunc code, void *para, u_char *rt_stack){
@@ -41,6 +69,55 @@ void port_rt_stack_init(vfunc code, void *para, u_char *rt_stack){
 }
 
 
+/*
+@ brief: Atomically add val to *addr without disabling interrupts.
+@ retv: The value before adding.
+*/
+u_int port_atomic_add(volatile u_int *addr, u_int val){
+	u_int old;
+	do {
+		old = __LDREXW(addr);
+	} while (__STREXW(old + val, addr) != 0);
+	return old;
+}
+
+
+/*
+@ brief: Atomically replace *addr with val if it still equals expect.
+@ retv: true -> replaced, false -> *addr has been changed by others.
+*/
+bool port_atomic_cas(volatile u_int *addr, u_int expect, u_int val){
+	do {
+		if (__LDREXW(addr) != expect){
+			__CLREX();
+			return false;
+		}
+	} while (__STREXW(val, addr) != 0);
+	return true;
+}
+
+
+#if CFG_MAX_PRIOS > 32
+// two-level bitmap: find the highest group first, then the highest bit in the group
+__asm int get_highest_priority(void){
+	extern prio_group
+	extern prio_bitmap
+	PRESERVE8
+
+	ldr  	r0, =prio_group
+	ldr  	r0, [r0]
+	rbit 	r0, r0
+	clz 	r1, r0				// r1 = group index
+	ldr  	r0, =prio_bitmap
+	ldr  	r0, [r0, r1, lsl #2]
+	rbit 	r0, r0
+	clz 	r0, r0
+	add  	r0, r0, r1, lsl #5	// r0 = group * 32 + bit
+	bx		lr
+	nop
+}
+
+#else
 __asm int get_highest_priority(void){
 	extern prio_bitmap
 	PRESERVE8
@@ -53,6 +130,8 @@ __asm int get_highest_priority(void){
 	nop
 }
 
+#endif
+
 
 __asm void enable_vfp(void){
 	PRESERVE8
@@ -75,7 +154,12 @@ __asm void PendSV_Handler(void){
 	extern schedule
 	PRESERVE8
 
+#if CFG_USE_BASEPRI_CRITICAL
+	mov 	r3, #BASEPRI_SYSCALL
+	msr 	basepri, r3
+#else
 	cpsid   i
+#endif
 	mrs 	r0, psp	 				// sp point to top of stack (r0)
 	isb		
 
@@ -107,7 +191,12 @@ __asm void PendSV_Handler(void){
 
 	msr 	psp, r0
 
+#if CFG_USE_BASEPRI_CRITICAL
+	mov 	r3, #0
+	msr 	basepri, r3
+#else
 	cpsie   i
+#endif
 	isb
 	bx  	lr
 	nop
@@ -176,8 +265,77 @@ static __asm void _start_first_task(void){
 #define PENDSV_PRIORITY 	((u_int)(0xFFul << 16))		// =15
 #define SYSTICK_PRIORITY 	((u_int)(0xFFul << 24))		// =15
 
+/*
+@ brief: Kernel timestamp, the DWT cycle counter by default.
+         Define a function with the same name to use another source.
+*/
+__weak u_int port_timestamp(void){
+	return DWT->CYCCNT;
+}
+
+
+#if CFG_USE_MPU_STACK_GUARD
+
+#define GUARD_SIZE      32
+// no access even for privileged code, execute never, 2^(4+1) = 32 bytes
+#define GUARD_RASR      (MPU_RASR_XN_Msk | (4u << MPU_RASR_SIZE_Pos) | MPU_RASR_ENABLE_Msk)
+
+/*
+@ brief: Get the RBAR value that moves the guard region to the bottom of a stack,
+         the value is kept in tcb->mpu_cfg.
+*/
+void* port_stack_guard_cfg(u_char *stack_start){
+	u_int base = ((u_int)stack_start + GUARD_SIZE-1) & ~(GUARD_SIZE-1);
+	return (void*)(base | MPU_RBAR_VALID_Msk | CFG_MPU_GUARD_REGION);
+}
+
+
+/*
+@ brief: Move the guard region to the next task's stack, called in PendSV.
+         Only RBAR changes, the region number is part of the value.
+*/
+void port_stack_guard_switch(void *mpu_cfg){
+	MPU->RBAR = (u_int)mpu_cfg;
+	__DSB();
+}
+
+
+// RBAR has been written by Kora_start() for the first task
+static void stack_guard_init(void){
+	MPU->RNR = CFG_MPU_GUARD_REGION;
+	MPU->RASR = GUARD_RASR;
+	MPU->CTRL = MPU_CTRL_PRIVDEFENA_Msk | MPU_CTRL_ENABLE_Msk;
+	SCB->SHCSR |= SCB_SHCSR_MEMFAULTENA_Msk;
+	__DSB();
+	__ISB();
+}
+
+
+void os_stack_fault(u_int addr);
+void MemManage_Handler(void){
+	u_int addr = (SCB->CFSR & SCB_CFSR_MMARVALID_Msk) ? SCB->MMFAR : 0;
+	os_stack_fault(addr);
+}
+
+#endif
+
+
+#if CFG_USE_CYCLE_ACCOUNTING
+void os_accounting_start(void);
+#endif
+
 void start_first_task(void){
 	lock_nesting = 0;
+#if CFG_USE_MPU_STACK_GUARD
+	stack_guard_init();
+#endif
+
+	CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;   // enable DWT cycle counter
+	DWT->CYCCNT = 0;
+	DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+#if CFG_USE_CYCLE_ACCOUNTING
+	os_accounting_start();
+#endif
 
 	enable_vfp();
 	FPCCR |= ASPEN_AND_LSPEN_BITS;  // use lazy stack
@@ -190,3 +348,86 @@ void start_first_task(void){
 	_start_first_task();
 }
 
+
+#if CFG_USE_TICKLESS_IDLE
+
+#define TICK_CYCLES           (CFG_CPU_CLOCK_HZ / CFG_TICK_PER_SEC)
+#define MAX_SUPPRESS_TICKS    (SysTick_LOAD_RELOAD_Msk / TICK_CYCLES)
+
+/*
+@ brief: Stop the periodic tick, sleep until expect_ticks passed or any interrupt arrives.
+         Called by idle task with interrupts disabled, WFI still wakes on pending interrupt.
+@ retv: Whole ticks passed during sleep, excluding the one that the pending SysTick 
+        interrupt is going to count.
+*/
+u_int port_suppress_ticks(u_int expect_ticks){
+	if (expect_ticks > MAX_SUPPRESS_TICKS)
+		expect_ticks = MAX_SUPPRESS_TICKS;
+
+	// reading CTRL clears COUNTFLAG, read it once and only write it afterwards
+	u_int ctrl = SysTick->CTRL & ~SysTick_CTRL_COUNTFLAG_Msk;
+	SysTick->CTRL = ctrl & ~SysTick_CTRL_ENABLE_Msk;
+
+	// the current tick period is partly used, so the sleep ends at a tick boundary
+	u_int reload = SysTick->VAL + TICK_CYCLES * (expect_ticks - 1);
+	if (reload > CFG_TICKLESS_RELOAD_CORRECTION)
+		reload -= CFG_TICKLESS_RELOAD_CORRECTION;
+
+	// a tick arrived while SysTick was being stopped, give up sleeping
+	if (SCB->ICSR & SCB_ICSR_PENDSTSET_Msk){
+		SysTick->LOAD = SysTick->VAL;
+		SysTick->VAL = 0;
+		SysTick->CTRL = ctrl;
+		SysTick->LOAD = TICK_CYCLES - 1;
+		return 0;
+	}
+
+	SysTick->LOAD = reload;
+	SysTick->VAL = 0;
+	SysTick->CTRL = ctrl;
+
+#if CFG_USE_BASEPRI_CRITICAL
+	// WFI ignores the interrupts masked by BASEPRI, use PRIMASK while sleeping
+	__disable_irq();
+	__set_BASEPRI(0);
+	__DSB();
+	__WFI();
+	__ISB();
+	__set_BASEPRI(BASEPRI_SYSCALL);
+	__enable_irq();
+#else
+	__DSB();
+	__WFI();
+	__ISB();
+#endif
+
+	u_int woken_ctrl = SysTick->CTRL;
+	SysTick->CTRL = ctrl & ~SysTick_CTRL_ENABLE_Msk;
+
+	u_int elapsed;
+	if (woken_ctrl & SysTick_CTRL_COUNTFLAG_Msk){
+		// the whole period passed, the pending SysTick interrupt counts the last tick,
+		// the next tick should come after the rest of a period
+		u_int next = (TICK_CYCLES - 1) - (reload - SysTick->VAL);
+		if (next <= CFG_TICKLESS_RELOAD_CORRECTION || next > TICK_CYCLES - 1)
+			next = TICK_CYCLES - 1;
+
+		SysTick->LOAD = next;
+		elapsed = expect_ticks - 1;
+	}
+	else {
+		// woken by other interrupt, count the whole ticks passed and 
+		// keep the next tick on the original tick boundary
+		u_int passed_cycles = expect_ticks * TICK_CYCLES - SysTick->VAL;
+		elapsed = passed_cycles / TICK_CYCLES;
+		SysTick->LOAD = (elapsed + 1) * TICK_CYCLES - passed_cycles;
+	}
+
+	SysTick->VAL = 0;
+	SysTick->CTRL = ctrl;
+	SysTick->LOAD = TICK_CYCLES - 1;
+
+	return elapsed;
+}
+
+#endif
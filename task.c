@@ -8,6 +8,8 @@
 
 #include "KoraConfig.h"
 #include "Kora.h"
+#include "csprof.h"
+#include "trace.h"
 
 #include <string.h>
 #include <stdio.h>
@@ -20,16 +22,16 @@
  * creation, deletion, context switching, and utility functions such as tick retrieval.
  * 
  * Tasks are organized and managed using linked lists and list nodes, allowing efficient
- * scheduling and state transitions.
+ * scheduling and state transitions. Sleeping tasks are kept in a timer wheel
+ * (CFG_USE_TIMER_WHEEL) or a sorted list.
  *
- * The scheduler supports up to 32 priority levels with preemptive and round-robin scheduling.
+ * The scheduler supports up to 256 priority levels with preemptive and round-robin scheduling,
+ * more than 32 levels use a two-level priority bitmap.
  *
  * Additionally, hook functions are provided to assist with debugging and system introspection.
  * 
  */
 
-#define SLEEP_STRATEGY_QUICK
-
 #define NL "\r\n"
 
 #if CFG_USE_KERNEL_HOOKS
@@ -42,17 +44,44 @@
 
 tcb_t * volatile current_tcb = NULL;
 
+#if CFG_MAX_PRIOS > 256
+	#error "CFG_MAX_PRIOS must not exceed 256"
+#elif CFG_MAX_PRIOS > 32
+// bit n of prio_group is set if prio_bitmap[n] is not empty
+u_int  prio_group = 0;
+u_int  prio_bitmap[(CFG_MAX_PRIOS + 31) / 32] = {0};
+
+#define PRIO_BITMAP_SET(prio)  do { prio_group |= 1u << ((prio) >> 5); \
+                                    prio_bitmap[(prio) >> 5] |= 1u << ((prio) & 31); } while (0)
+#define PRIO_BITMAP_CLR(prio)  do { if ((prio_bitmap[(prio) >> 5] &= ~(1u << ((prio) & 31))) == 0) \
+                                        prio_group &= ~(1u << ((prio) >> 5)); } while (0)
+#else
 u_int  prio_bitmap = 0;
+
+#define PRIO_BITMAP_SET(prio)  (prio_bitmap |= 1u << (prio))
+#define PRIO_BITMAP_CLR(prio)  (prio_bitmap &= ~(1u << (prio)))
+#endif
+
 bool   flag_actively_sched = false;
 u_int  lock_nesting = 0;
 
 static list_t          ready_lists[CFG_MAX_PRIOS];
 static list_node_t    *task_iter[CFG_MAX_PRIOS];
+#if CFG_USE_TIMER_WHEEL
+static timer_wheel     sleep_wheel;
+#else
 static list_t          sleep_list;
+#endif
 static list_t          all_tasks;
 
+#if CFG_USE_WEIGHTED_RR
+static bool            level_weighted[CFG_MAX_PRIOS];
+static bool            turn_kept[CFG_MAX_PRIOS];       // the task at task_iter was preempted in its turn
+static u_int           level_ticks[CFG_MAX_PRIOS];     // ticks run by the level since os_reset_share()
+#endif
+
 static int       highest_prio = CFG_MAX_PRIOS-1;
-static u_int     os_tick_count = 0;
+static volatile tick_t  os_tick_count = 0;
 static int       switch_disable = 1;
 
 
@@ -60,22 +89,206 @@ static int       switch_disable = 1;
 void start_first_task(void); 
 int  get_highest_priority(void);
 void port_rt_stack_init(vfunc code, void *para, u_char *rt_stack);
+#if CFG_USE_TICKLESS_IDLE
+u_int port_suppress_ticks(u_int expect_ticks);
+#endif
+u_int port_timestamp(void);
+#if CFG_USE_MPU_STACK_GUARD
+void* port_stack_guard_cfg(u_char *stack_start);
+void port_stack_guard_switch(void *mpu_cfg);
+#endif
+
+// defined in timer.c
+#if CFG_USE_SOFT_TIMER
+void swtimer_tick(u_int now);
+u_int swtimer_next_expire(u_int now);
+#endif
+
+// defined in pendcall.c
+#if CFG_USE_PEND_CALL
+void pend_call_init(void);
+#endif
 
 
 #define STATE_NODE_TO_TCB(pnode)    ((tcb_t*)( (u_int)(pnode) - offsetof(tcb_t, state_node)) )
+#define EVENT_NODE_TO_TCB(pnode)    ((tcb_t*)( (u_int)(pnode) - offsetof(tcb_t, event_node)) )
 #define LINK_NODE_TO_TCB(pnode)     ((tcb_t*)( (u_int)(pnode) - offsetof(tcb_t, link_node)) )
 
+#if CFG_USE_MPU_STACK_GUARD
+// the lowest 32-byte aligned block of each stack is a no-access MPU region
+#define STACK_GUARD_SIZE            32
+#define STACK_BOTTOM(tsk)           ((u_int*)( (((u_int)(tsk)->start_addr + STACK_GUARD_SIZE-1) \
+                                               & ~(STACK_GUARD_SIZE-1)) + STACK_GUARD_SIZE ))
+#else
+#define STACK_BOTTOM(tsk)           ((u_int*)( ((u_int)(tsk)->start_addr + 3) & ALIGN4MASK ))
+#endif
+
+#if CFG_USE_STACK_PAINT
+// Stacks are filled with STACK_PAINT when created, the lowest aligned word 
+// above the guard holds STACK_CANARY.
+#define STACK_PAINT                 0xA5A5A5A5u
+#define STACK_CANARY                0x5AC3A55Au
+
+static list_node_t *scan_cursor = NULL;     // link_node of the next task to scan, see scan_next_stack()
+static volatile u_int stack_releases = 0;   // bumped when a stack is given back, see stack_scan()
+#endif
+
+// Low word of the tick count. Wake deadlines are stored in this width and
+// compared by (int)(a - b), so they never need to be rewritten on overflow.
+#define TICK_NOW                    ((u_int)os_tick_count)
+
 /********************************** task state **********************************/
+
+#if CFG_USE_EDF
+#if CFG_EDF_PRIO >= CFG_MAX_PRIOS-1
+	#error "CFG_EDF_PRIO must be higher than the idle task's priority"
+#endif
+
+/*
+@ brief: Insert the task into the ready list of EDF band, earliest deadline first.
+@ retv: 1 -> the task has the earliest deadline of the band
+*/
+static int edf_insert(task_handle tsk){
+	list_t *lst = ready_lists + CFG_EDF_PRIO;
+	list_node_t *pos = FIRST_OF(*lst);
+
+	while (pos != &lst->dmy && (int)(tsk->deadline - STATE_NODE_TO_TCB(pos)->deadline) >= 0)
+		pos = pos->next;
+
+	list_insert_before(lst, pos, &tsk->state_node);
+	return FIRST_OF(*lst) == &tsk->state_node;
+}
+
+#endif
+
+
+#if CFG_USE_PREEMPT_THRESHOLD
+// tasks preempted by a task above their threshold, in preemption order, 
+// so the top one has the lowest threshold, see threshold_holder()
+static tcb_t    *preempted[CFG_MAX_PRIOS];
+static int       preempted_top = 0;
+
+/*
+@ brief: Check whether the threshold of a ready task is raised above its priority.
+@ note: A task throttled by its cpu budget loses the threshold until replenished,
+        otherwise a demoted task would keep the cpu through it.
+*/
+static inline bool threshold_raised(tcb_t *tsk){
+	return tsk->threshold < tsk->priority
+		&& tsk->state_node.leader == ready_lists + tsk->priority
+#if CFG_USE_CPU_BUDGET
+		&& !IS_THROTTLED(tsk)
+#endif
+		;
+}
+
+
+/*
+@ brief: Check whether the running task keeps the cpu against a ready task of prio.
+@ note: Only when its threshold is raised above its priority, otherwise the
+        plain priority rules (and round-robin) apply.
+*/
+static inline bool running_holds(u_int prio){
+	tcb_t *cur = current_tcb;
+	return cur != NULL && threshold_raised(cur) && prio >= cur->threshold;
+}
+
+
+/*
+@ brief: Get the preempted task whose threshold still applies, NULL if none.
+@ note: A task leaves the stack when it runs again or is no longer ready.
+*/
+static tcb_t* threshold_holder(void){
+	while (preempted_top > 0){
+		tcb_t *tsk = preempted[preempted_top - 1];
+		if (tsk != current_tcb && threshold_raised(tsk))
+			return tsk;
+		--preempted_top;
+	}
+	return NULL;
+}
+
+
+/*
+@ brief: Check whether a ready task of prio must wait, because of the threshold
+         of the running task or of a preempted task that has not finished.
+*/
+static inline bool threshold_holds(u_int prio){
+	if (running_holds(prio))
+		return true;
+
+	tcb_t *held = threshold_holder();
+	return held != NULL && prio >= held->threshold;
+}
+
+
+/*
+@ brief: Remember the task switched out by schedule() if it was preempted 
+         with a raised threshold.
+*/
+static void threshold_push(tcb_t *old){
+	if (old == NULL || old == current_tcb || !threshold_raised(old))
+		return;
+
+	threshold_holder();
+	os_assert(preempted_top < CFG_MAX_PRIOS);
+	preempted[preempted_top++] = old;
+}
+
+
+// drop a deleted task from the preempted stack
+static void threshold_forget(tcb_t *tsk){
+	for (int i = 0; i < preempted_top; ++i){
+		if (preempted[i] == tsk){
+			for (--preempted_top; i < preempted_top; ++i)
+				preempted[i] = preempted[i + 1];
+			break;
+		}
+	}
+}
+
+#endif
+
+
 /*
 @ brief: Add the task to ready_list and update highest_prio
 @ retv: 0-> highest priority has not changed 
-        1-> the task becomes the only and highest priority task
+        1-> the task becomes the only and highest priority task,
+            or the earliest deadline task when EDF band is the highest
+@ note: Also 0 if the running task's preemption threshold stops the task.
 */
 static int add_to_ready(task_handle tsk){ 
 	u_int prio = tsk->priority;
-	prio_bitmap |= 1 << prio; 
+	TRACE(trace_task_ready, tsk);
+	PRIO_BITMAP_SET(prio);
 	tsk->state = ready;
 
+#if CFG_USE_PREEMPT_THRESHOLD
+	if (threshold_holds(prio)){
+	#if CFG_USE_EDF
+		if (prio == CFG_EDF_PRIO)
+			edf_insert(tsk);
+		else
+	#endif
+		list_insert_end(ready_lists+prio, &tsk->state_node);
+
+		if (prio < highest_prio)
+			highest_prio = prio;
+		return 0;
+	}
+#endif
+
+#if CFG_USE_EDF
+	if (prio == CFG_EDF_PRIO){
+		int earliest = edf_insert(tsk);
+		if (prio < highest_prio){
+			highest_prio = prio;
+			return 1;
+		}
+		return earliest && prio == highest_prio;
+	}
+#endif
+
 	list_insert_end(ready_lists+prio, &tsk->state_node);
 	if (prio < highest_prio){
 		highest_prio = prio;
@@ -91,16 +304,82 @@ static int add_to_ready(task_handle tsk){
 static void remove_from_ready(task_handle tsk){
 	u_int prio = tsk->priority;
 	if (ready_lists[prio].list_len == 1)
-		prio_bitmap &= ~(1 << prio);
+		PRIO_BITMAP_CLR(prio);
 
-	if (task_iter[prio] == &tsk->state_node)
+	if (task_iter[prio] == &tsk->state_node){
 		task_iter[prio] = tsk->state_node.prev;
+#if CFG_USE_WEIGHTED_RR
+		turn_kept[prio] = false;
+#endif
+	}
 
 	list_remove(&tsk->state_node);
 	highest_prio = get_highest_priority();
 }
 
 
+/*
+@ brief: Insert the task into a block list by priority, tasks of EDF band 
+         are also sorted by deadline among themselves.
+*/
+static void insert_waiter(list_t *blklst, task_handle tsk){
+#if CFG_USE_EDF
+	if (tsk->priority == CFG_EDF_PRIO){
+		list_node_t *pos = FIRST_OF(*blklst);
+		while (pos != &blklst->dmy && (pos->value < CFG_EDF_PRIO || (pos->value == CFG_EDF_PRIO 
+			&& (int)(tsk->deadline - EVENT_NODE_TO_TCB(pos)->deadline) >= 0)))
+			pos = pos->next;
+
+		list_insert_before(blklst, pos, &tsk->event_node);
+		return;
+	}
+#endif
+	list_insert(blklst, &tsk->event_node);
+}
+
+
+// keep a blocked task at its place in the block list after its key changed
+static void resort_waiter(task_handle tsk){
+	list_t *blklst = tsk->event_node.leader;
+	if (blklst != NULL){
+		list_remove(&tsk->event_node);
+		insert_waiter(blklst, tsk);
+	}
+}
+
+
+/*
+@ brief: Change the priority of a task in any state, in critical.
+@ retv: Same as add_to_ready(), 0 if the task is not ready.
+*/
+static int set_priority(task_handle tsk, u_int prio){
+	bool is_ready = (tsk->state <= ready);
+	if (is_ready)
+		remove_from_ready(tsk);
+
+	tsk->priority = prio;
+	tsk->event_node.value = prio;
+	resort_waiter(tsk);
+	return is_ready ? add_to_ready(tsk) : 0;
+}
+
+
+#if CFG_USE_CPU_BUDGET
+/*
+@ brief: Get the priority the task runs at under its budget.
+@ note: A demoted task runs at demote_prio, unless a mutex waiter lent it a 
+        higher one, the lock must be released before the waiter can go on.
+*/
+static u_int budget_prio(task_handle tsk){
+	if (!IS_THROTTLED(tsk) || tsk->budget->action != budget_demote)
+		return tsk->base_prio;
+
+	u_int demote = tsk->budget->demote_prio;
+	return tsk->inherited && tsk->base_prio < demote ? tsk->base_prio : demote;
+}
+#endif
+
+
 /*
 @ brief: Modify the task's priority.
 @ retv: Task's old priority.
@@ -108,60 +387,109 @@ static void remove_from_ready(task_handle tsk){
 int task_modify_priority(task_handle tsk, int new_prio){
 	os_assert(new_prio < CFG_MAX_PRIOS);
 
-	int old = tsk->priority;
 	enter_critical();
 
-	remove_from_ready(tsk);
-	tsk->event_node.value = new_prio;
-	tsk->priority = new_prio;
-	add_to_ready(tsk);
+#if CFG_USE_CPU_BUDGET
+	// mutex inheritance and the user both change base_prio, a demoted
+	// task runs at budget_prio() and takes base_prio when replenished
+	int old = tsk->base_prio;
+	tsk->base_prio = new_prio;
+	set_priority(tsk, budget_prio(tsk));
+#else
+	int old = tsk->priority;
+	set_priority(tsk, new_prio);
+#endif
 
 	exit_critical();
 	return old;
 }
 
 
-static inline void remove_ready_node(task_handle tsk){
-	if (tsk->state <= ready)
-		remove_from_ready(tsk);
-	else 
-		list_remove(&tsk->state_node);
-} 
+#if CFG_USE_PREEMPT_THRESHOLD
+/*
+@ brief: Set the preemption threshold of the task, while the task runs only
+         the tasks of higher priority than threshold can preempt it.
+@ param: threshold -> must not be lower than the task's priority (numerically 
+                      not larger), equal to priority means no threshold.
+@ retv: The old threshold.
+@ note: Tasks that never preempt each other are never on their stacks at the
+        same time, so they can share the worst-case stack budget.
+*/
+u_int task_set_preempt_threshold(task_handle tsk, u_int threshold){
+	if (tsk == NULL)  tsk = current_tcb;
+	os_assert(threshold <= tsk->priority && threshold >= PRIORITY_HIGHEST);
+
+	enter_critical();
+	u_int old = tsk->threshold;
+	tsk->threshold = threshold;
+	bool need_sched = (tsk == current_tcb && switch_disable == 0 
+	                   && highest_prio < current_tcb->priority && !threshold_holds(highest_prio));
+	exit_critical();
+
+	// a lowered threshold may let a waiting task in
+	if (need_sched)
+		call_sched();
+	return old;
+}
+
+#endif
 
 
-#ifdef SLEEP_STRATEGY_QUICK
+#if CFG_USE_EDF
 /*
-@ brief: If sleep time overflow(sleep tick + os_tick_count > UINT_MAX), 
-         reset every task's sleep time and reset tick count.
+@ brief: Set the task's absolute deadline to rel_ticks from now and move it into 
+         the EDF band, tasks of the band are scheduled by earliest deadline.
+@ note: Call it again at the start of every period to release the next job.
 */
-static void tick_reset(void){
-	list_node_t *iter = FIRST_OF(sleep_list);
+void task_set_deadline(task_handle tsk, u_int rel_ticks){
+	if (tsk == NULL)  tsk = current_tcb;
+
 	enter_critical();
-	for (int i = 0; i < sleep_list.list_len; ++i){
-		iter->value -= os_tick_count;
-		iter = iter->next;
-	}
-	os_tick_count = 0;
+
+	bool is_ready = (tsk->state <= ready);
+	if (is_ready)
+		remove_from_ready(tsk);
+
+	tsk->deadline = TICK_NOW + rel_ticks;
+	tsk->priority = CFG_EDF_PRIO;
+#if CFG_USE_CPU_BUDGET
+	tsk->base_prio = CFG_EDF_PRIO;
+#endif
+	tsk->event_node.value = CFG_EDF_PRIO;
+	resort_waiter(tsk);    // EDF waiters are sorted by deadline too
+
+	int has_changed = is_ready ? add_to_ready(tsk) : 0;
 	exit_critical();
+
+	if (has_changed || tsk == current_tcb)
+		call_sched();
 }
 
 #endif
 
+
+static inline void remove_ready_node(task_handle tsk){
+	if (tsk->state <= ready)
+		remove_from_ready(tsk);
+	else 
+		list_remove(&tsk->state_node);
+} 
+
+
 /*
 @ brief: Add the task to sleep_list
 */
 static void add_to_sleep(task_handle tsk, u_int xtick){
+	// deadlines are compared by (int)(a - b), keep them within INT_MAX
+	if (xtick > INT_MAX)
+		xtick = INT_MAX;
 
-#ifdef SLEEP_STRATEGY_QUICK
-	if (xtick > UINT_MAX-os_tick_count)
-		tick_reset();
-
-	xtick += os_tick_count;
-	tsk->state_node.value = xtick;
-	list_insert(&sleep_list, &tsk->state_node);
+#if CFG_USE_TIMER_WHEEL
+	tsk->state_node.value = TICK_NOW + xtick;
+	timer_wheel_insert(&sleep_wheel, &tsk->state_node);
 
 #else
-	u_int wake_tick = os_tick_count + xtick;
+	u_int wake_tick = TICK_NOW + xtick;
 	list_node_t *node = &tsk->state_node;
 	node->value = wake_tick;
 
@@ -225,6 +553,8 @@ void task_ready_isr(task_handle tsk){
 
 /*
 @ brief: Used to make a running task self-block
+@ param: blklst -> NULL means the task is not mounted on any block list
+                   and can only be woken by task_ready() or timeout.
 @ note: To make sure that function's execution will not be interrupted,
         must make lock_nesting == 1 before entering the function, 
         lock_nesting is also equal to 1 when exiting function.
@@ -232,6 +562,7 @@ void task_ready_isr(task_handle tsk){
 void block(list_t *blklst, u_int overtime_ticks){
 	os_assert(lock_nesting == 1);
 	os_assert(switch_disable == 0);
+	TRACE(trace_task_block, blklst);
 
 	current_tcb->state = blocking;
 	if (overtime_ticks != 0){
@@ -241,7 +572,8 @@ void block(list_t *blklst, u_int overtime_ticks){
 		else
 			current_tcb->state_node.value = UINT_MAX;
 
-		list_insert(blklst, &current_tcb->event_node);
+		if (blklst != NULL)
+			insert_waiter(blklst, current_tcb);
 	}
 
 	exit_critical();
@@ -254,6 +586,7 @@ void block(list_t *blklst, u_int overtime_ticks){
 
 void block_isr(task_handle tsk, list_t *blklst, u_int overtime_ticks){
 	os_assert(tsk != NULL);
+	TRACE(trace_task_block, blklst);
 
 	tsk->state = blocking;
 	if (overtime_ticks != 0){
@@ -261,7 +594,7 @@ void block_isr(task_handle tsk, list_t *blklst, u_int overtime_ticks){
 		if (overtime_ticks != UINT_MAX)
 			add_to_sleep(tsk, overtime_ticks);
 
-		list_insert(blklst, &tsk->event_node);
+		insert_waiter(blklst, tsk);
 	}
 
 	if (tsk == current_tcb)
@@ -269,17 +602,33 @@ void block_isr(task_handle tsk, list_t *blklst, u_int overtime_ticks){
 }
 
 
+#if CFG_USE_CPU_BUDGET
+/*
+@ brief: Forget the throttle of a suspended member, called when the task is 
+         suspended by task_suspend(), so the replenish does not resume it.
+*/
+static void budget_forget(task_handle tsk){
+	if (IS_THROTTLED(tsk) && tsk->budget->action == budget_suspend)
+		list_remove(&tsk->budget_node);
+}
+#endif
+
+
 /*
 @ brief: Change the task state to suspend
 */
 void task_suspend(task_handle tsk){
 	if (tsk == NULL)  tsk = current_tcb;
+	TRACE(trace_task_suspend, tsk);
 
 	enter_critical();
 
 	remove_ready_node(tsk);
 	list_remove(&tsk->event_node);
 	tsk->state = suspend;
+#if CFG_USE_CPU_BUDGET
+	budget_forget(tsk);
+#endif
 
 	exit_critical();
 
@@ -290,10 +639,14 @@ void task_suspend(task_handle tsk){
 
 void task_suspend_isr(task_handle tsk){
 	os_assert(tsk != NULL);
+	TRACE(trace_task_suspend, tsk);
 
 	remove_ready_node(tsk);
 	list_remove(&tsk->event_node);
 	tsk->state = suspend;
+#if CFG_USE_CPU_BUDGET
+	budget_forget(tsk);
+#endif
 
 	if (current_tcb == tsk)
 		call_sched_isr();
@@ -305,6 +658,7 @@ void task_suspend_isr(task_handle tsk){
 */
 void sleep(u_int xtick){
 	os_assert(switch_disable == 0);
+	TRACE(trace_task_sleep, xtick);
 	enter_critical();
 
 	current_tcb->state = sleeping;
@@ -317,104 +671,570 @@ void sleep(u_int xtick){
 }
 
 
-u_int task_left_sleep_tick(task_handle tsk){
-	u_int tick = tsk->state_node.value;
-	if (tick == UINT_MAX)
-		return UINT_MAX;
+/*
+@ brief: Sleep until the absolute tick *last_wake + period, then update *last_wake to it.
+@ note: The wake ticks only depend on the first *last_wake, so a loop of 
+        work() and sleep_until() keeps an exact period whatever work() costs.
+        If the wake tick has already passed, return immediately.
+*/
+void sleep_until(u_int *last_wake, u_int period){
+	os_assert(switch_disable == 0);
+	os_assert(period <= INT_MAX);
 
-	if (tick > os_tick_count)
-		return tick - os_tick_count;
+	enter_critical();
+	u_int wake = *last_wake + period;
+	*last_wake = wake;
 
-	return 0;
-}
+	int left = wake - TICK_NOW;
+	if (left <= 0){
+		exit_critical();
+		return;
+	}
 
+	TRACE(trace_task_sleep, left);
+	current_tcb->state = sleeping;
+	remove_from_ready(current_tcb);
+	add_to_sleep(current_tcb, left);
 
-task_stat task_state(task_handle tsk){
-	return tsk->state;
+	exit_critical();
+	call_sched();
 }
 
 
-task_handle os_get_running_task(void){
-	return current_tcb;
+/*
+@ brief: Make the running task periodic, its first job is released now.
+@ param: pd -> descriptor keeps the release time and statistics, must stay 
+               valid while the task is periodic.
+*/
+void task_set_periodic(periodic_t *pd, u_int period){
+	os_assert(period > 0 && period <= INT_MAX);
+
+	memset(pd, 0, sizeof(periodic_t));
+	pd->period = period;
+	pd->release = TICK_NOW;
+	current_tcb->periodic = pd;
 }
 
 
-task_handle task_self(void){
-	return current_tcb;
-}
+/*
+@ brief: End the current job of the periodic task and sleep until the next release.
+@ note: A job that ends after the next release is an overrun, the next job starts 
+        at once. If whole periods have passed, their releases are skipped and
+        counted as missed, the task stays in phase with its first release.
+*/
+void task_wait_next_period(void){
+	periodic_t *pd = current_tcb->periodic;
+	os_assert(pd != NULL);
+
+	u_int next = pd->release + pd->period;
+	int late = TICK_NOW - next;
+
+	pd->jobs += 1;
+	if (late > 0){
+		u_int skipped = (u_int)late / pd->period;
+		pd->overruns += 1;
+		pd->missed += skipped;
+		next += skipped * pd->period;
+	}
 
+	pd->release = next - pd->period;
+	sleep_until(&pd->release, pd->period);
 
-char* task_name(task_handle tsk){
-	if (tsk == NULL)
-		tsk = current_tcb;
-	return tsk->name;
+	// how late the job starts after its release
+	u_int jitter = TICK_NOW - pd->release;
+	if (jitter > pd->max_jitter)
+		pd->max_jitter = jitter;
+	pd->total_jitter += jitter;
 }
 
 
+#if CFG_USE_CPU_BUDGET
+#if !CFG_USE_SOFT_TIMER
+	#error "CFG_USE_CPU_BUDGET needs CFG_USE_SOFT_TIMER to replenish budgets"
+#endif
+
+#define BUDGET_NODE_TO_TCB(pnode)  ((tcb_t*)( (u_int)(pnode) - offsetof(tcb_t, budget_node)) )
+
 /*
-@ brief: Iterate all tasks and execute process()
+@ brief: Charge one tick to the budget of the running task, called by tick handler.
+@ retv: true if the budget is used up and the task must be throttled.
+@ note: A throttled task is not charged, a demoted one runs for free in background.
 */
-void foreach_task(task_process_t process, void *para){
-	list_node_t *iter = &(all_tasks.dmy);
-
-	while ((iter = iter->next) != &(all_tasks.dmy)){
-		process(LINK_NODE_TO_TCB(iter), para);
-	}
+static bool budget_charge(task_handle tsk){
+	cpu_budget_t *b = tsk->budget;
+	if (b == NULL || IS_THROTTLED(tsk))
+		return false;
+
+	if (++b->used == b->capacity)
+		b->overruns += 1;
+	return b->used >= b->capacity;
 }
 
 
-task_handle task_find(char *name){
-	list_node_t *iter = all_tasks.dmy.next;
-	
-	while (iter != &(all_tasks.dmy)){
-		tcb_t *ptsk = LINK_NODE_TO_TCB(iter);
+/*
+@ brief: Demote or suspend the running task until its budget is replenished.
+@ note: The task must be ready, a task on its way to sleep or block is 
+        throttled at a later tick. Other members of a group are throttled 
+        when they run their next tick.
+*/
+static void budget_throttle(task_handle tsk){
+	cpu_budget_t *b = tsk->budget;
 
-		if (strncmp(name, ptsk->name, CFG_TASK_NAME_LEN) == 0)
-			return ptsk;
-		iter = iter->next;
+	list_insert_end(&b->throttled, &tsk->budget_node);
+	if (b->action == budget_suspend){
+		TRACE(trace_task_suspend, tsk);
+		remove_ready_node(tsk);
+		list_remove(&tsk->event_node);
+		tsk->state = suspend;
 	}
-	return NULL;
+	else
+		set_priority(tsk, budget_prio(tsk));
 }
 
 
-/***************************** create and delete *****************************/
+// give a throttled task back its priority or resume it, in critical
+static int budget_release(task_handle tsk){
+	list_remove(&tsk->budget_node);
+	if (tsk->budget->action == budget_demote)
+		return set_priority(tsk, budget_prio(tsk));
 
-// used to check whether TCB data is accidentally overwritten
-#define TCB_MAGIC_NUM 	0x0F984F1Cul
+	// the task may have been resumed by task_ready() meanwhile
+	if (tsk->state != suspend)
+		return 0;
+	return add_to_ready(tsk);
+}
 
-/*
-@ brief: Initialize tcb structure.
-*/
-static void tcb_init(tcb_t *tcb, u_int prio, const char *name, u_char *start){
-	strncpy(tcb->name, name, CFG_TASK_NAME_LEN);
-	tcb->name[CFG_TASK_NAME_LEN-1] = 0;
-	tcb->priority = prio;
-	tcb->top_of_stack = (u_char*)((u_int)tcb - sizeof(u_int)*17);
-	tcb->start_addr = (u_char*)start;
-	tcb->state = ready;
-	tcb->mpu_cfg = NULL;
-	tcb->user_data = NULL;
 
-	LIST_NODE_INIT(&tcb->state_node);
-	LIST_NODE_INIT(&tcb->event_node);
-	LIST_NODE_INIT(&tcb->link_node);
+static void budget_replenish(void *para){
+	cpu_budget_t *b = para;
+	int need_sched = 0;
 
-	tcb->magic = TCB_MAGIC_NUM;
-	tcb->min_stack = 999999;
-	tcb->occupied_tick = 0;
-	tcb->event_node.value = prio;
-	tcb->evt_flags = 0;
+	enter_critical();
+	b->used = 0;
+
+	// release one member per critical section, the interrupt latency does 
+	// not grow with the number of throttled members
+	while (LIST_NOT_EMPTY(&b->throttled)){
+		need_sched |= budget_release(BUDGET_NODE_TO_TCB(FIRST_OF(b->throttled)));
+		exit_critical();
+		enter_critical();
+	}
+	exit_critical();
 
-	list_insert_end(&all_tasks, &tcb->link_node);
+	if (need_sched)
+		call_sched();
 }
 
 
 /*
-@ brief: Initialize task's tcb structure and runtime stack,
-         after Initialize, task will enter the schedule.
+@ brief: Initialize a cpu budget and start replenishing it every period ticks.
+@ param: capacity -> ticks all members together may run per period.
+         action -> budget_demote: members run at demote_prio after the budget is used up.
+                   budget_suspend: members are suspended after the budget is used up.
 */
-tcb_t* task_init(vfunc code, const char *name, void *para, u_int prio, u_char *stk, int size){
-	os_assert(size >= CFG_MIN_STACK_SIZE);
+void budget_init(cpu_budget_t *b, u_int capacity, u_int period, budget_action_t action, u_int demote_prio){
+	os_assert(capacity > 0 && capacity < period);
+	os_assert(demote_prio < CFG_MAX_PRIOS);
+
+	b->capacity = capacity;
+	b->used = 0;
+	b->overruns = 0;
+	b->action = action;
+	b->demote_prio = demote_prio;
+	list_init(&b->throttled);
+	swtimer_init(&b->timer, budget_replenish, b, period, true);
+	swtimer_start(&b->timer);
+}
+
+
+/*
+@ brief: Make the task a member of budget b, the ticks it runs are charged to b.
+@ param: b -> NULL to remove the task from its budget, a throttled task is released.
+*/
+void task_set_budget(task_handle tsk, cpu_budget_t *b){
+	if (tsk == NULL)  tsk = current_tcb;
+	int need_sched = 0;
+
+	enter_critical();
+	if (IS_THROTTLED(tsk))
+		need_sched = budget_release(tsk);
+	tsk->budget = b;
+	exit_critical();
+
+	if (need_sched)
+		call_sched();
+}
+
+#endif
+
+
+/*
+@ brief: Set how many ticks the task runs before yielding to a task of the same priority.
+@ param: ticks -> 0 means use CFG_DEFAULT_TIME_SLICE
+*/
+void task_set_time_slice(task_handle tsk, u_int ticks){
+	if (tsk == NULL)  tsk = current_tcb;
+	if (ticks == 0)   ticks = CFG_DEFAULT_TIME_SLICE;
+	os_assert(ticks <= USHRT_MAX);
+
+	enter_critical();
+	tsk->time_slice = ticks;
+	if (tsk->slice_left > ticks)
+		tsk->slice_left = ticks;
+	exit_critical();
+}
+
+
+/*
+@ brief: Get how many times the task was rotated out for using up its time slice.
+*/
+u_int task_slice_expired_count(task_handle tsk){
+	return tsk->slice_expired;
+}
+
+
+#if CFG_USE_WEIGHTED_RR
+/*
+@ brief: Switch the round-robin of a priority level to deficit round-robin.
+@ note: In a weighted level a task keeps the unused part of its quantum when it 
+        is preempted or blocks, and continues with it at its next turn, so each 
+        task gets a share of the level in proportion to its weight.
+*/
+void os_set_weighted_level(u_int prio, bool weighted){
+	os_assert(prio < CFG_MAX_PRIOS);
+	level_weighted[prio] = weighted;
+}
+
+
+bool os_is_weighted_level(u_int prio){
+	return level_weighted[prio];
+}
+
+
+/*
+@ brief: Set the weight of the task, its quantum becomes weight * CFG_WEIGHT_QUANTUM ticks.
+@ param: weight -> 1 ~ 255
+*/
+void task_set_weight(task_handle tsk, u_int weight){
+	if (tsk == NULL)  tsk = current_tcb;
+	os_assert(weight > 0 && weight <= UCHAR_MAX);
+
+	tsk->weight = weight;
+	task_set_time_slice(tsk, weight * CFG_WEIGHT_QUANTUM);
+}
+
+
+/*
+@ brief: Get the permille of ticks the task has run among its weighted level
+         since os_reset_share().
+*/
+u_int task_share(task_handle tsk){
+	u_int total = level_ticks[tsk->priority];
+	if (total == 0)
+		return 0;
+
+	return (u_int)((unsigned long long)tsk->share_ticks * 1000 / total);
+}
+
+
+/*
+@ brief: Called by schedule(), when the switched out task of a weighted level
+         is preempted by a higher level with quantum left, the level resumes
+         it instead of the next task, otherwise frequent preemption from above 
+         would cost it whole turns and flatten the weights.
+*/
+static void keep_turn(tcb_t *old){
+	if (old != NULL && current_tcb->priority < old->priority && level_weighted[old->priority]
+		&& old->slice_left > 0 && old->state_node.leader == ready_lists + old->priority)
+		turn_kept[old->priority] = true;
+}
+
+
+static void clear_share(task_handle tsk, void *prio){
+	if (tsk->priority == (u_int)prio)
+		tsk->share_ticks = 0;
+}
+
+
+/*
+@ brief: Restart measuring the shares of the level.
+*/
+void os_reset_share(u_int prio){
+	os_assert(prio < CFG_MAX_PRIOS);
+
+	enter_critical();
+	level_ticks[prio] = 0;
+	foreach_task(clear_share, (void*)prio);
+	exit_critical();
+}
+
+#endif
+
+
+u_int task_left_sleep_tick(task_handle tsk){
+	u_int tick = tsk->state_node.value;
+	if (tick == UINT_MAX)
+		return UINT_MAX;
+
+	if ((int)(tick - TICK_NOW) > 0)
+		return tick - TICK_NOW;
+
+	return 0;
+}
+
+
+/*
+@ brief: Get the stack size of the task, including the tcb on its top.
+*/
+u_int task_stack_size(task_handle tsk){
+	return (u_char*)tsk + sizeof(tcb_t) - tsk->start_addr;
+}
+
+
+task_stat task_state(task_handle tsk){
+	return tsk->state;
+}
+
+
+task_handle os_get_running_task(void){
+	return current_tcb;
+}
+
+
+task_handle task_self(void){
+	return current_tcb;
+}
+
+
+char* task_name(task_handle tsk){
+#if CFG_TASK_NAME_LEN > 0
+	if (tsk == NULL)
+		tsk = current_tcb;
+	return tsk->name;
+#else
+	return "";
+#endif
+}
+
+
+/*
+@ brief: Iterate all tasks and execute process()
+*/
+void foreach_task(task_process_t process, void *para){
+	list_node_t *iter = &(all_tasks.dmy);
+
+	while ((iter = iter->next) != &(all_tasks.dmy)){
+		process(LINK_NODE_TO_TCB(iter), para);
+	}
+}
+
+
+#if CFG_USE_TASK_NAME_HASH
+/*
+	Name index: an open addressing table of tcb pointers with linear probing, 
+	slot chosen by the name hash stored in tcb. A deleted entry becomes a
+	tombstone so that probing goes on past it, insertion reuses them. When
+	tombstones exceed a quarter of the slots the table is rebuilt, so 
+	create/delete cycles do not lengthen the probes. If the table fills up, 
+	task_find() falls back to walking all_tasks until a delete makes room.
+*/
+#if (CFG_TASK_HASH_SLOTS & (CFG_TASK_HASH_SLOTS - 1)) != 0
+	#error "CFG_TASK_HASH_SLOTS must be a power of 2"
+#endif
+#if CFG_TASK_NAME_LEN == 0
+	#error "CFG_USE_TASK_NAME_HASH needs task names, CFG_TASK_NAME_LEN is 0"
+#endif
+
+#define HASH_MASK         (CFG_TASK_HASH_SLOTS - 1)
+#define HASH_TOMBSTONE    ((tcb_t*)1)
+
+static tcb_t  *name_index[CFG_TASK_HASH_SLOTS];
+static bool    name_index_full = false;
+static u_int   name_tombstones = 0;
+
+
+// FNV-1a
+static u_int name_hash(const char *name){
+	u_int hash = 2166136261u;
+	for (int i = 0; i < CFG_TASK_NAME_LEN && name[i]; ++i){
+		hash ^= (u_char)name[i];
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+
+static void name_index_add(tcb_t *tcb){
+	u_int idx = tcb->name_hash;
+
+	for (int i = 0; i < CFG_TASK_HASH_SLOTS; ++i, ++idx){
+		tcb_t **slot = name_index + (idx & HASH_MASK);
+		if (*slot == NULL || *slot == HASH_TOMBSTONE){
+			if (*slot == HASH_TOMBSTONE)
+				--name_tombstones;
+			*slot = tcb;
+			return;
+		}
+	}
+	name_index_full = true;
+}
+
+
+// drop all tombstones and add every task again, in critical
+static void name_index_rebuild(void){
+	memset(name_index, 0, sizeof(name_index));
+	name_tombstones = 0;
+	name_index_full = false;
+
+	for (list_node_t *it = FIRST_OF(all_tasks); it != &all_tasks.dmy; it = it->next)
+		name_index_add(LINK_NODE_TO_TCB(it));
+}
+
+
+/*
+@ brief: Remove the task from the name index, it's already off all_tasks.
+@ note: The rebuild is bounded by CFG_TASK_HASH_SLOTS, and happens at most
+        once every CFG_TASK_HASH_SLOTS/4 deletes unless the table was full.
+*/
+static void name_index_del(tcb_t *tcb){
+	u_int idx = tcb->name_hash;
+
+	for (int i = 0; i < CFG_TASK_HASH_SLOTS; ++i, ++idx){
+		tcb_t **slot = name_index + (idx & HASH_MASK);
+		if (*slot == tcb){
+			*slot = HASH_TOMBSTONE;
+			++name_tombstones;
+			break;
+		}
+		if (*slot == NULL)
+			break;
+	}
+
+	// a full table may have room for the tasks left out now
+	if (name_index_full || name_tombstones > CFG_TASK_HASH_SLOTS / 4)
+		name_index_rebuild();
+}
+
+
+static tcb_t* name_index_find(const char *name){
+	u_int hash = name_hash(name);
+	u_int idx = hash;
+
+	for (int i = 0; i < CFG_TASK_HASH_SLOTS; ++i, ++idx){
+		tcb_t *tcb = name_index[idx & HASH_MASK];
+		if (tcb == NULL)
+			break;
+
+		// different hashes never need the string compare
+		if (tcb != HASH_TOMBSTONE && tcb->name_hash == hash 
+			&& strncmp(name, tcb->name, CFG_TASK_NAME_LEN) == 0)
+			return tcb;
+	}
+	return NULL;
+}
+
+#endif
+
+
+task_handle task_find(char *name){
+#if CFG_TASK_NAME_LEN == 0
+	return NULL;
+#else
+#if CFG_USE_TASK_NAME_HASH
+	if (!name_index_full)
+		return name_index_find(name);
+#endif
+
+	list_node_t *iter = all_tasks.dmy.next;
+	
+	while (iter != &(all_tasks.dmy)){
+		tcb_t *ptsk = LINK_NODE_TO_TCB(iter);
+
+		if (strncmp(name, ptsk->name, CFG_TASK_NAME_LEN) == 0)
+			return ptsk;
+		iter = iter->next;
+	}
+	return NULL;
+#endif
+}
+
+
+/***************************** create and delete *****************************/
+
+// used to check whether TCB data is accidentally overwritten
+#define TCB_MAGIC_NUM 	0x0F984F1Cul
+
+/*
+@ brief: Initialize tcb structure.
+*/
+static void tcb_init(tcb_t *tcb, u_int prio, const char *name, u_char *start){
+#if CFG_TASK_NAME_LEN > 0
+	strncpy(tcb->name, name, CFG_TASK_NAME_LEN);
+	tcb->name[CFG_TASK_NAME_LEN-1] = 0;
+#endif
+	tcb->priority = prio;
+	tcb->top_of_stack = (u_char*)((u_int)tcb - sizeof(u_int)*17);
+	tcb->start_addr = (u_char*)start;
+	tcb->state = ready;
+	tcb->mpu_cfg = NULL;
+
+	LIST_NODE_INIT(&tcb->state_node);
+	LIST_NODE_INIT(&tcb->event_node);
+	LIST_NODE_INIT(&tcb->link_node);
+
+#if CFG_USE_TCB_DEBUG
+	tcb->magic = TCB_MAGIC_NUM;
+	tcb->min_stack = 999999;
+	tcb->user_data = NULL;
+#endif
+	tcb->slice_expired = 0;
+	tcb->occupied_tick = 0;
+#if CFG_USE_CYCLE_ACCOUNTING
+	tcb->run_cycles = 0;
+#endif
+	tcb->event_node.value = prio;
+	tcb->evt_flags = 0;
+	tcb->time_slice = CFG_DEFAULT_TIME_SLICE;
+	tcb->slice_left = CFG_DEFAULT_TIME_SLICE;
+#if CFG_USE_WEIGHTED_RR
+	tcb->weight = 1;
+	tcb->share_ticks = 0;
+#endif
+	tcb->periodic = NULL;
+#if CFG_USE_CPU_BUDGET
+	tcb->budget = NULL;
+	tcb->inherited = false;
+	LIST_NODE_INIT(&tcb->budget_node);
+	tcb->base_prio = prio;
+#endif
+#if CFG_USE_PREEMPT_THRESHOLD
+	tcb->threshold = prio;
+#endif
+#if CFG_TASK_NOTIFY_SLOTS > 0
+	for (int i = 0; i < CFG_TASK_NOTIFY_SLOTS; ++i){
+		tcb->notify_value[i] = 0;
+		tcb->notify_state[i] = notify_idle;
+	}
+#endif
+#if CFG_USE_EDF
+	tcb->deadline = TICK_NOW;
+#endif
+
+	list_insert_end(&all_tasks, &tcb->link_node);
+#if CFG_USE_TASK_NAME_HASH
+	tcb->name_hash = name_hash(tcb->name);
+	name_index_add(tcb);
+#endif
+	TRACE_TASK_CREATE(tcb);
+}
+
+
+/*
+@ brief: Initialize task's tcb structure and runtime stack,
+         after Initialize, task will enter the schedule.
+*/
+tcb_t* task_init(vfunc code, const char *name, void *para, u_int prio, u_char *stk, int size){
+	os_assert(size >= CFG_MIN_STACK_SIZE);
 	os_assert(prio <= PRIORITY_LOWEST);
 
 	static bool first_time_call = true;
@@ -426,24 +1246,172 @@ tcb_t* task_init(vfunc code, const char *name, void *para, u_int prio, u_char *s
 		list_init(&all_tasks);
 		first_time_call = false;
 	}
-	
-	u_char *stktop = (u_char*)( (u_int)stk + size);
-	tcb_t *new_tcb = (tcb_t*)( (u_int)(stktop - sizeof(tcb_t)) & ALIGN4MASK);
-	
-	tcb_init(new_tcb, prio, name, stk);
-	port_rt_stack_init(code, para, (u_char*)new_tcb);
-	add_to_ready(new_tcb);
-	kn_print("Task created at %p, name = %s, priority = %d"NL, new_tcb, name, prio);
+	
+	u_char *stktop = (u_char*)( (u_int)stk + size);
+	tcb_t *new_tcb = (tcb_t*)( (u_int)(stktop - sizeof(tcb_t)) & ALIGN4MASK);
+	
+	tcb_init(new_tcb, prio, name, stk);
+#if CFG_USE_MPU_STACK_GUARD
+	os_assert(size >= CFG_MIN_STACK_SIZE + 2*STACK_GUARD_SIZE);
+	new_tcb->mpu_cfg = port_stack_guard_cfg(stk);
+#endif
+#if CFG_USE_STACK_PAINT
+	u_int *bottom = STACK_BOTTOM(new_tcb);
+	memset(bottom, STACK_PAINT & 0xFF, (u_char*)new_tcb - (u_char*)bottom);
+	*bottom = STACK_CANARY;
+#endif
+	port_rt_stack_init(code, para, (u_char*)new_tcb);
+	add_to_ready(new_tcb);
+	kn_print("Task created at %p, name = %s, priority = %d"NL, new_tcb, name, prio);
+
+	return new_tcb;
+}
+
+
+#if CFG_USE_STACK_POOL
+/*
+	Stack pools: each size class is a chunk of equal blocks cut from heap once,
+	free blocks are linked through their first word. The tcb lives on the top 
+	of its stack, so one block holds both, create and delete never touch heap.
+*/
+#if !CFG_ALLOW_DYNAMIC_ALLOC
+	#error "stack pools are cut from heap, CFG_ALLOW_DYNAMIC_ALLOC is needed"
+#endif
+
+static const u_int pool_size[] = CFG_STACK_POOL_SIZES;
+static const u_int pool_count[] = CFG_STACK_POOL_COUNTS;
+
+#define POOL_CLASSES   (sizeof(pool_size) / sizeof(pool_size[0]))
+
+static u_char        *pool_base[POOL_CLASSES];
+static linked_list   *pool_free[POOL_CLASSES];
+static volatile bool  pool_inited = false;
+static u_char        *pending_release = NULL;    // stack of a task that deleted itself
+
+
+/*
+@ brief: Cut the pools from heap, the chunks are allocated and linked outside 
+         the critical section and only published inside it.
+*/
+static void stack_pool_init(void){
+	u_char *base[POOL_CLASSES];
+	linked_list *head[POOL_CLASSES];
+
+	for (int c = 0; c < POOL_CLASSES; ++c){
+		base[c] = malloc(pool_size[c] * pool_count[c]);
+		os_assert(base[c] != NULL);
+
+		head[c] = NULL;
+		for (int i = pool_count[c] - 1; i >= 0; --i){
+			linked_list *blk = (linked_list*)(base[c] + i * pool_size[c]);
+			blk->next = head[c];
+			head[c] = blk;
+		}
+	}
+
+	enter_critical();
+	bool lost = pool_inited;     // another task has done it meanwhile
+	if (!lost){
+		for (int c = 0; c < POOL_CLASSES; ++c){
+			pool_base[c] = base[c];
+			pool_free[c] = head[c];
+		}
+		pool_inited = true;
+	}
+	exit_critical();
+
+	if (lost){
+		for (int c = 0; c < POOL_CLASSES; ++c)
+			free(base[c]);
+	}
+}
+
+
+/*
+@ brief: Take a free block of the smallest class that fits size.
+@ retv: The block, NULL if no class has a free block large enough.
+*/
+static u_char* stack_pool_get(int size, int *block_size){
+	u_char *blk = NULL;
+
+	if (!pool_inited)
+		stack_pool_init();
+
+	enter_critical();
+	for (int c = 0; c < POOL_CLASSES; ++c){
+		if (pool_size[c] >= size && pool_free[c] != NULL){
+			blk = (u_char*)pool_free[c];
+			pool_free[c] = pool_free[c]->next;
+			*block_size = pool_size[c];
+			break;
+		}
+	}
+	exit_critical();
+	return blk;
+}
+
+
+// get the class that the stack belongs to, -1 if not pooled
+static int stack_pool_class(u_char *stk){
+	for (int c = 0; c < POOL_CLASSES; ++c){
+		if (pool_base[c] != NULL && stk >= pool_base[c] 
+			&& stk < pool_base[c] + pool_size[c] * pool_count[c])
+			return c;
+	}
+	return -1;
+}
 
-	return new_tcb;
+
+// give the block back to its pool, must be protected by the caller
+static void stack_pool_put(u_char *stk, int cls){
+	linked_list *blk = (linked_list*)stk;
+	blk->next = pool_free[cls];
+	pool_free[cls] = blk;
+}
+
+#endif
+
+
+/*
+@ brief: Give back the stack of a deleted task, must be protected by the caller.
+@ note: A pooled stack is reusable at once, except that a task deleting itself
+        is still running on it, then the stack is returned at the next switch.
+        A watermark scan in progress is told by stack_releases.
+*/
+static void release_stack(task_handle tsk){
+#if CFG_USE_STACK_PAINT
+	++stack_releases;
+#endif
+#if CFG_USE_STACK_POOL
+	int cls = stack_pool_class(tsk->start_addr);
+	if (cls >= 0){
+		if (tsk == current_tcb)
+			pending_release = tsk->start_addr;
+		else
+			stack_pool_put(tsk->start_addr, cls);
+		return;
+	}
+#endif
+	queue_free(tsk->start_addr);
 }
 
 
 /*
 @ brief: Dynamic allocate a memory and initialize the task
+@ note: With stack pools, the smallest free pooled block that fits is used,
+        the heap is only the fallback.
 */
 tcb_t* task_create(vfunc code, const char *name, void *para, u_int prio, int size){
-	u_char *stack = malloc(size);
+	u_char *stack = NULL;
+
+#if CFG_USE_STACK_POOL
+	int block_size;
+	stack = stack_pool_get(size, &block_size);
+	if (stack != NULL)
+		return task_init(code, name, para, prio, stack, block_size);
+#endif
+
+	stack = malloc(size);
 	if (!stack)
 		return NULL;
 
@@ -457,14 +1425,11 @@ tcb_t* task_create(vfunc code, const char *name, void *para, u_int prio, int siz
 tcb_t* qcreate(vfunc code, int priority, int size){
 	static char nqtask = 0;
 
-	u_char *stack = malloc(size);
-	if (!stack)
-		return NULL;
-
 	char name[] = "qtask_x";
 	name[6] = nqtask + '1';
-	tcb_t *ret = task_init(code, name, NULL, priority, stack, size);
-	nqtask++;
+	tcb_t *ret = task_create(code, name, NULL, priority, size);
+	if (ret != NULL)
+		nqtask++;
 	return ret;
 }
 
@@ -473,14 +1438,29 @@ void task_delete(task_handle tsk){
 	enter_critical();
 
 	EXECUTE_HOOK(hook_task_delete, tsk);
+	TRACE(trace_task_delete, tsk);
 
 	remove_ready_node(tsk);
 	list_remove(&tsk->event_node);
+#if CFG_USE_STACK_PAINT
+	// keep the stack scan cursor off the removed node
+	if (scan_cursor == &tsk->link_node)
+		scan_cursor = tsk->link_node.next;
+#endif
 	list_remove(&tsk->link_node);
+#if CFG_USE_PREEMPT_THRESHOLD
+	threshold_forget(tsk);
+#endif
+#if CFG_USE_CPU_BUDGET
+	list_remove(&tsk->budget_node);
+#endif
+#if CFG_USE_TASK_NAME_HASH
+	name_index_del(tsk);
+#endif
 
-	queue_free(tsk->start_addr);
+	release_stack(tsk);
 
-	kn_print("Task deleted: name = %s"NL, tsk->name);
+	kn_print("Task deleted: name = %s"NL, task_name(tsk));
 	exit_critical();
 	call_sched();
 }
@@ -488,14 +1468,29 @@ void task_delete(task_handle tsk){
 
 void task_delete_isr(task_handle tsk){
 	EXECUTE_HOOK(hook_task_delete, tsk);
+	TRACE(trace_task_delete, tsk);
 
 	remove_ready_node(tsk);
 	list_remove(&tsk->event_node);
+#if CFG_USE_STACK_PAINT
+	// keep the stack scan cursor off the removed node
+	if (scan_cursor == &tsk->link_node)
+		scan_cursor = tsk->link_node.next;
+#endif
 	list_remove(&tsk->link_node);
+#if CFG_USE_PREEMPT_THRESHOLD
+	threshold_forget(tsk);
+#endif
+#if CFG_USE_CPU_BUDGET
+	list_remove(&tsk->budget_node);
+#endif
+#if CFG_USE_TASK_NAME_HASH
+	name_index_del(tsk);
+#endif
 	
-	queue_free(tsk->start_addr);
+	release_stack(tsk);
 
-	kn_print("Task deleted: name = %s"NL, tsk->name);
+	kn_print("Task deleted: name = %s"NL, task_name(tsk));
 
 	call_sched_isr();
 }
@@ -526,8 +1521,13 @@ void enable_task_switch(void){
 
 	--switch_disable;
 
-	if (switch_disable == 0 && highest_prio < current_tcb->priority)
+	if (switch_disable == 0 && highest_prio < current_tcb->priority){
+#if CFG_USE_PREEMPT_THRESHOLD
+		if (threshold_holds(highest_prio))
+			return;
+#endif
 		call_sched();
+	}
 }
 
 
@@ -539,93 +1539,500 @@ bool is_scheduler_running(void){
 /*
 @ brief: Check whether task's stack used up
 */
+#if CFG_USE_STACK_PAINT
+#if !CFG_USE_MPU_STACK_GUARD
+static void stack_safety_check(void){
+	// the canary at the bottom is only overwritten when the stack overflows
+	if (*STACK_BOTTOM(current_tcb) != STACK_CANARY){
+		EXECUTE_HOOK(hook_stack_overf_isr, current_tcb);
+		kn_print("Stack overflow in task %s"NL, task_name(current_tcb));
+	}
+}
+#endif
+
+
+/*
+@ brief: Scan the painted stack for the high watermark, runs with interrupts enabled.
+@ param: releases -> stack_releases read while tsk was surely alive.
+@ note: The task may be deleted meanwhile and its stack and tcb handed to a new 
+        task, then the result is dropped instead of written into the new tcb.
+*/
+static u_int stack_scan(task_handle tsk, u_int releases){
+	u_int *bottom = STACK_BOTTOM(tsk);
+	u_int *p = bottom + 1;
+
+	while (p < (u_int*)tsk && *p == STACK_PAINT)
+		++p;
+
+	u_int free_size = (u_char*)p - (u_char*)bottom;
+#if CFG_USE_TCB_DEBUG
+	enter_critical();
+	if (releases == stack_releases)
+		tsk->min_stack = free_size;
+	exit_critical();
+#else
+	(void)releases;
+#endif
+	return free_size;
+}
+
+
+/*
+@ brief: Scan the painted stack for the high watermark, also update tsk->min_stack.
+@ retv: Bytes of the stack that have never been used.
+*/
+u_int task_stack_watermark(task_handle tsk){
+	return stack_scan(tsk, stack_releases);
+}
+
+
+/*
+@ brief: Scan the stack of one task, called by idle task once per tick, 
+         so every watermark is refreshed without touching the switch path.
+*/
+static void scan_next_stack(void){
+	tcb_t *tsk = NULL;
+	u_int releases;
+
+	enter_critical();
+	releases = stack_releases;
+	if (scan_cursor == NULL || scan_cursor == &all_tasks.dmy)
+		scan_cursor = FIRST_OF(all_tasks);
+
+	if (scan_cursor != &all_tasks.dmy){
+		tsk = LINK_NODE_TO_TCB(scan_cursor);
+		scan_cursor = scan_cursor->next;
+	}
+	exit_critical();
+
+	if (tsk != NULL)
+		stack_scan(tsk, releases);
+}
+
+#else
 static void stack_safety_check(void){
 	int free_stk_size = current_tcb->top_of_stack - current_tcb->start_addr;
 	if (free_stk_size < 40){
 		EXECUTE_HOOK(hook_stack_overf_isr, current_tcb);
-		kn_print("Stack overflow in task %s"NL, current_tcb->name);
+		kn_print("Stack overflow in task %s"NL, task_name(current_tcb));
 	}
 
+#if CFG_USE_TCB_DEBUG
 	if (free_stk_size < current_tcb->min_stack)
 		current_tcb->min_stack = free_stk_size;
+#endif
+}
+
+#endif
+
+
+#if CFG_USE_MPU_STACK_GUARD
+/*
+@ brief: Called by MemManage handler when the running task touched its stack guard.
+@ param: addr -> the faulting address, 0 if unknown.
+*/
+void os_stack_fault(u_int addr){
+	EXECUTE_HOOK(hook_stack_overf_isr, current_tcb);
+	kn_print("Stack overflow in task %s, address 0x%08X"NL, task_name(current_tcb), addr);
+	while (1) {};
+}
+
+#endif
+
+
+/******************************* cpu accounting *******************************/
+
+static volatile u_int isr_nesting = 0;
+
+#if CFG_USE_CYCLE_ACCOUNTING
+static u_int     switch_stamp = 0;
+static cycle_t   total_cycles = 0;
+
+#if CFG_CYCLE_ACCOUNT_ISR
+static u_int     isr_stamp = 0;
+static u_int     isr_cycles = 0;     // isr time not yet subtracted from a task
+static cycle_t   isr_total_cycles = 0;
+#endif
+
+/*
+@ brief: Charge the cycles since last call to the running task.
+@ note: Called at every task switch and every tick, so the 32-bit 
+        cycle counter is never read across a wrap.
+*/
+static void account_cycles(void){
+	u_int now = port_timestamp();
+	u_int used = now - switch_stamp;
+	switch_stamp = now;
+	total_cycles += used;
+
+#if CFG_CYCLE_ACCOUNT_ISR
+	used -= isr_cycles;
+	isr_total_cycles += isr_cycles;
+	isr_cycles = 0;
+#endif
+
+	current_tcb->run_cycles += used;
+}
+
+
+/*
+@ brief: Get the cpu time of the task in cycles since it was created.
+*/
+cycle_t task_run_cycles(task_handle tsk){
+	enter_critical();
+	cycle_t cycles = tsk->run_cycles;
+	exit_critical();
+	return cycles;
+}
+
+
+/*
+@ brief: Take the first stamp, called by the port once the timestamp counter runs.
+@ note: The counter is started (and reset) in start_first_task(), a stamp taken 
+        before would charge garbage to the first task.
+*/
+void os_accounting_start(void){
+	switch_stamp = port_timestamp();
+}
+
+
+/*
+@ brief: Get the cycles passed since the scheduler started.
+*/
+cycle_t os_get_total_cycles(void){
+	enter_critical();
+	cycle_t cycles = total_cycles;
+	exit_critical();
+	return cycles;
+}
+
+#endif
+
+
+/*
+@ brief: Call at the entry and exit of interrupt handlers, so the kernel
+         knows the time spent in interrupts.
+*/
+void os_isr_enter(void){
+#if CFG_USE_CYCLE_ACCOUNTING && CFG_CYCLE_ACCOUNT_ISR
+	if (isr_nesting == 0)
+		isr_stamp = port_timestamp();
+#endif
+	isr_nesting += 1;
+	TRACE(trace_isr_enter, isr_nesting);
 }
 
 
+void os_isr_exit(void){
+	TRACE(trace_isr_exit, isr_nesting);
+	isr_nesting -= 1;
+#if CFG_USE_CYCLE_ACCOUNTING && CFG_CYCLE_ACCOUNT_ISR
+	if (isr_nesting == 0)
+		isr_cycles += port_timestamp() - isr_stamp;
+#endif
+}
+
+
+/***************************** task switch *****************************/
+
 /*
 @ brief: Find next task to execute
 */
 void schedule(void){
+#if !CFG_USE_MPU_STACK_GUARD || !CFG_USE_STACK_PAINT
+	// with the MPU guard an overflow faults at once, the check is only
+	// kept to measure min_stack when stacks are not painted
 	stack_safety_check();
-	list_node_t **it = &(task_iter[highest_prio]);
-	(*it) = (*it)->next;
-	if (*it == &(ready_lists[highest_prio].dmy))
+#endif
+#if CFG_USE_CYCLE_ACCOUNTING
+	account_cycles();
+#endif
+#if CFG_USE_STACK_POOL
+	// the task that deleted itself has left its stack for good
+	if (pending_release != NULL){
+		stack_pool_put(pending_release, stack_pool_class(pending_release));
+		pending_release = NULL;
+	}
+#endif
+	u_int prio = highest_prio;
+	bool advance = true;
+#if CFG_USE_PREEMPT_THRESHOLD
+	// no task above the threshold, the running task goes on
+	if (running_holds(prio))
+		return;
+
+	// a preempted task resumes before any task below its threshold
+	tcb_t *held = threshold_holder();
+	if (held != NULL && prio >= held->threshold){
+		prio = held->priority;
+		task_iter[prio] = &held->state_node;
+		advance = false;
+	}
+#endif
+#if CFG_USE_WEIGHTED_RR
+	// the task preempted from above goes on with its turn
+	if (turn_kept[prio]){
+		turn_kept[prio] = false;
+		advance = false;
+	}
+#endif
+	list_node_t **it = &(task_iter[prio]);
+
+#if CFG_USE_EDF
+	// EDF band is kept in deadline order, always run the head
+	if (prio == CFG_EDF_PRIO)
+		(*it) = FIRST_OF(ready_lists[CFG_EDF_PRIO]);
+	else
+#endif
+	if (advance){
 		(*it) = (*it)->next;
+		if (*it == &(ready_lists[prio].dmy))
+			(*it) = (*it)->next;
+	}
 	
+
 	task_switched_info_t hook_para = {current_tcb, NULL};
 	current_tcb = STATE_NODE_TO_TCB(*it);
+#if CFG_USE_PREEMPT_THRESHOLD
+	threshold_push(hook_para.old_tcb);
+#endif
+#if CFG_USE_WEIGHTED_RR
+	keep_turn(hook_para.old_tcb);
+#endif
+#if CFG_USE_WEIGHTED_RR
+	// deficit round-robin, the quantum is refilled only when used up
+	if (!level_weighted[current_tcb->priority] || current_tcb->slice_left == 0)
+#endif
+	current_tcb->slice_left = current_tcb->time_slice;
 	hook_para.cur_tcb = current_tcb;
 
 	EXECUTE_HOOK(hook_task_switched_isr, &hook_para);
+	TRACE(trace_task_switch, hook_para.old_tcb);
+#if CFG_USE_MPU_STACK_GUARD
+	port_stack_guard_switch(current_tcb->mpu_cfg);
+#endif
 
+#if CFG_USE_TCB_DEBUG
 	if (current_tcb->magic != TCB_MAGIC_NUM){
 		kn_print("overflows occurred in some places, and the tcb was corrupted"NL);
 		while (1) {};
 	}
+#endif
 }
 
 
-static void wake_task_from_sleep(void){
-	list_node_t *first = FIRST_OF(sleep_list);
-	tcb_t *tsk;
+static wake_stat_t wake_stat;
 
-#ifdef SLEEP_STRATEGY_QUICK
-	if (os_tick_count >= first->value){
-		tsk = STATE_NODE_TO_TCB(first);
-		list_remove(&tsk->event_node);
-		list_remove(&tsk->state_node);
-		add_to_ready(tsk);
-	}
+/*
+@ brief: Move a due task from sleep queue to ready list and record how late it is.
+*/
+static void wake_one(tcb_t *tsk){
+	u_int late = TICK_NOW - tsk->state_node.value;
+	if (late > wake_stat.max_late)
+		wake_stat.max_late = late;
+	wake_stat.total_late += late;
+
+	list_remove(&tsk->event_node);
+	list_remove(&tsk->state_node);
+	add_to_ready(tsk);
+}
+
+
+#if CFG_USE_TIMER_WHEEL
+static inline bool sleep_queue_due(void){
+	return LIST_NOT_EMPTY(TIMER_WHEEL_EXPIRED(&sleep_wheel));
+}
+
+static inline tcb_t* sleep_queue_first(void){
+	return STATE_NODE_TO_TCB(FIRST_OF(*TIMER_WHEEL_EXPIRED(&sleep_wheel)));
+}
 
 #else
-	if ((int)(first->value - os_tick_count) < 0){
-		tsk = STATE_NODE_TO_TCB(first);
-		list_remove(&tsk->event_node);
-		list_remove(&tsk->state_node);
-		add_to_ready(tsk);
-	}
+static inline bool sleep_queue_due(void){
+	if (LIST_IS_EMPTY(&sleep_list))
+		return false;
+
+	return (int)(FIRST_OF(sleep_list)->value - TICK_NOW) <= 0;
+}
+
+static inline tcb_t* sleep_queue_first(void){
+	return STATE_NODE_TO_TCB(FIRST_OF(sleep_list));
+}
+
+#endif
+
+
+/*
+@ brief: Wake every task whose sleep time is up in one pass.
+@ note: At most CFG_MAX_WAKE_PER_TICK tasks are woken (0 means no limit),
+        the remainder stay at the head of the sleep queue and are woken
+        first at the next tick.
+*/
+static void wake_task_from_sleep(void){
+	u_int woken = 0;
+
+#if CFG_USE_TIMER_WHEEL
+	timer_wheel_advance(&sleep_wheel, TICK_NOW);
 #endif
 
+	while (sleep_queue_due()){
+#if CFG_MAX_WAKE_PER_TICK > 0
+		if (woken == CFG_MAX_WAKE_PER_TICK){
+			wake_stat.deferred += 1;
+			break;
+		}
+#endif
+		wake_one(sleep_queue_first());
+		++woken;
+	}
+
+	wake_stat.last_woken = woken;
+	wake_stat.total_woken += woken;
+	if (woken > wake_stat.max_woken)
+		wake_stat.max_woken = woken;
 }
 
 
 /*
-@ brief: 
+@ brief: Wake the sleeping tasks and decide whether to switch task, once per tick.
 @ note: Action of the flag_actively_sched: If a task actively gives up CPU time by called call_sched(), 
-                the handler will not trigger a task switch when the next tick arrives
+                the handler will not trigger a round-robin switch when the next tick arrives,
+                but a higher priority task woken in this tick still preempts.
 */
 void os_tick_handler(void){
-	EXECUTE_HOOK(hook_systick_isr, &os_tick_count);
+	EXECUTE_HOOK(hook_systick_isr, (void*)&os_tick_count);
 
 	if (current_tcb == NULL)
 		return;
 
+	// a nested interrupt must not see a half updated 64-bit count
+	enter_critical();
 	os_tick_count += 1;
+	exit_critical();
 	current_tcb->occupied_tick += 1;
-	if (switch_disable > 0 || flag_actively_sched == true){
-		flag_actively_sched = false;
+#if CFG_USE_CYCLE_ACCOUNTING
+	account_cycles();
+#endif
+#if CFG_USE_WEIGHTED_RR
+	if (level_weighted[current_tcb->priority]){
+		current_tcb->share_ticks += 1;
+		level_ticks[current_tcb->priority] += 1;
+	}
+#endif
+#if CFG_USE_CPU_BUDGET
+	bool over_budget = budget_charge(current_tcb);
+#endif
+
+	wake_task_from_sleep();
+#if CFG_USE_SOFT_TIMER
+	swtimer_tick(TICK_NOW);
+#endif
+
+	bool yielded = flag_actively_sched;
+	flag_actively_sched = false;
+	if (switch_disable > 0)
+		return;
+
+#if CFG_USE_CPU_BUDGET
+	// throttling waits until task switch is enabled and the task is ready,
+	// the ticks are still charged
+	if (over_budget && current_tcb->state <= ready){
+		budget_throttle(current_tcb);
+		call_sched_isr();
 		return;
 	}
+#endif
 
-	if (LIST_NOT_EMPTY(&sleep_list))
-		wake_task_from_sleep();
-	
-	if (current_tcb->priority == highest_prio && LIST_LEN(ready_lists+highest_prio) == 1)
+	if (yielded && highest_prio >= current_tcb->priority)
+		return;
+
+#if CFG_USE_PREEMPT_THRESHOLD
+	// no preemption and no round-robin below the threshold
+	if (threshold_holds(highest_prio))
 		return;
+#endif
+
+	if (current_tcb->priority == highest_prio){
+		if (LIST_LEN(ready_lists+highest_prio) == 1)
+			return;
+
+#if CFG_USE_EDF
+		// no time slicing in EDF band, only an earlier deadline preempts
+		if (highest_prio == CFG_EDF_PRIO && FIRST_OF(ready_lists[CFG_EDF_PRIO]) == &current_tcb->state_node)
+			return;
+#endif
+
+		// round-robin only when the quantum is used up
+		if (--current_tcb->slice_left > 0)
+			return;
+		current_tcb->slice_expired += 1;
+	}
 
 	call_sched_isr();
 }
 
 
+/*
+@ brief: Get the statistics of waking sleeping tasks in tick handler.
+*/
+wake_stat_t* os_get_wake_stat(void){
+	return &wake_stat;
+}
+
+
+#if CFG_USE_TICKLESS_IDLE
+/*
+@ brief: Get how many ticks later the sleep queue or a software timer may have something to do.
+*/
+static u_int next_wake_delta(void){
+#if CFG_USE_TIMER_WHEEL
+	u_int delta = timer_wheel_next_expire(&sleep_wheel, TICK_NOW);
+
+#else
+	u_int delta = UINT_MAX;
+	if (LIST_NOT_EMPTY(&sleep_list)){
+		int left = FIRST_OF(sleep_list)->value - TICK_NOW;
+		delta = left > 0 ? left : 0;
+	}
+#endif
+
+#if CFG_USE_SOFT_TIMER
+	u_int timer_delta = swtimer_next_expire(TICK_NOW);
+	if (timer_delta < delta)
+		delta = timer_delta;
+#endif
+	return delta;
+}
+
+
+/*
+@ brief: When only idle task is ready, stop the periodic tick and sleep until 
+         the next wake deadline or any interrupt, then credit the passed ticks.
+@ retv: Ticks credited to os_tick_count.
+*/
+static u_int tickless_idle(void){
+	u_int elapsed = 0;
+	enter_critical();
+
+	if (switch_disable == 0 && highest_prio == PRIORITY_LOWEST 
+		&& LIST_LEN(ready_lists+PRIORITY_LOWEST) == 1){
+		u_int expect = next_wake_delta();
+
+		if (expect >= CFG_TICKLESS_MIN_IDLE_TICKS){
+			CSPROF_DISCARD();   // the sleep is no interrupt latency
+			elapsed = port_suppress_ticks(expect);
+			os_tick_count += elapsed;
+			current_tcb->occupied_tick += elapsed;
+		}
+	}
+
+	exit_critical();
+	return elapsed;
+}
+
+#endif
+
+
 #define IDLE_TASK_STACK_SIZE  	512
 static u_char idle_stack[IDLE_TASK_STACK_SIZE];
 
@@ -637,7 +2044,9 @@ static u_int begin_tick = 0;
 @ brief: Idle task, do the following:
            free memory using queue_free()
            calculate cpu utilization
+           scan one task's stack watermark per tick
            execute idle hook 
+           stop the tick and sleep if tickless idle is enabled
 */
 static void idle_task(void *nothing){
 	extern linked_list *wait_for_free;
@@ -655,17 +2064,25 @@ static void idle_task(void *nothing){
 		}
 
 		// calculate the cpu utilization, update every 400 ticks
-		if (last_tick != os_tick_count){
+		if (last_tick != TICK_NOW){
 			++idle_tick;
-			last_tick = os_tick_count;
+			last_tick = TICK_NOW;
+#if CFG_USE_STACK_PAINT
+			scan_next_stack();
+#endif
 		}
-			if (os_tick_count - begin_tick >= 400){
-			cpu_utilization = 100 - idle_tick/4;
-			begin_tick = os_tick_count;
+			if (TICK_NOW - begin_tick >= 400){
+			// a tickless sleep may stretch the window beyond 400 ticks
+			cpu_utilization = 100 - idle_tick*100 / (TICK_NOW - begin_tick);
+			begin_tick = TICK_NOW;
 			idle_tick = 0;
 		}
 
 		EXECUTE_HOOK(hook_idle, NULL);
+
+#if CFG_USE_TICKLESS_IDLE
+		idle_tick += tickless_idle();
+#endif
 	}
 }
 
@@ -674,14 +2091,32 @@ static void idle_task(void *nothing){
 @ brief: Use idle task to calculate cpu utilization, poor precision
 */
 int os_get_cpu_utilization(void){
-	if (os_tick_count - begin_tick > 400)
+	if (TICK_NOW - begin_tick > 400)
 		return 100;
 	return cpu_utilization;
 }
 
 
 int os_get_tick(void){
-	return os_tick_count;
+	return TICK_NOW;
+}
+
+
+/*
+@ brief: Get the 64-bit monotonic tick count, it never wraps.
+@ note: The tick handler updates the count with interrupts disabled, a reader
+        preempted between the two words retries until the high word is stable.
+*/
+tick_t os_get_tick64(void){
+	volatile u_int *word = (volatile u_int*)&os_tick_count;  // little endian
+	u_int hi, lo;
+
+	do {
+		hi = word[1];
+		lo = word[0];
+	} while (hi != word[1]);
+
+	return ((tick_t)hi << 32) | lo;
 }
 
 
@@ -697,9 +2132,20 @@ int os_get_task_num(void){
 @ brief: Do initialization operations and start scheduler
 */
 void Kora_start(void){
+#if CFG_USE_TIMER_WHEEL
+	timer_wheel_init(&sleep_wheel, 0);
+#else
 	list_init(&sleep_list);
+#endif
 	current_tcb = task_init(idle_task, "idle", NULL, CFG_MAX_PRIOS-1, 
 	                        idle_stack, IDLE_TASK_STACK_SIZE);
+#if CFG_USE_PEND_CALL
+	pend_call_init();
+#endif
+
+#if CFG_USE_MPU_STACK_GUARD
+	port_stack_guard_switch(current_tcb->mpu_cfg);
+#endif
 
 	os_tick_count = 0;
 	switch_disable = 0;
@@ -0,0 +1,189 @@
+/*
+ * Kora rtos
+ * Copyright (c) 2024 biaboi
+ *
+ * This file is part of this project and is licensed under the MIT License.
+ * See the LICENSE file in the project root for full license information.
+ */
+
+#include "KoraConfig.h"
+#include "Kora.h"
+
+
+/**
+ * @file timer.c
+ * @brief Software timers.
+ *
+ * Active timers are kept in a timer wheel advanced by the tick handler,
+ * due timers are moved to the expired list of the wheel and the timer task
+ * is woken to run their callbacks, so a callback may use any blocking api.
+ *
+ * A periodic timer is rearmed before its callback runs, the next expire
+ * tick is counted from the previous one, so the period does not drift
+ * even if the timer task runs late.
+ */
+
+#if CFG_USE_SOFT_TIMER
+
+#define NODE_TO_TIMER(pnode) ((swtimer*)( (u_int)(pnode) - offsetof(swtimer, node)) )
+
+static timer_wheel   timers;
+static list_t        daemon_wait;          // the timer task blocks here when nothing expired
+static task_handle   daemon = NULL;
+static u_char        daemon_stack[CFG_SOFT_TIMER_STACK_SIZE];
+
+
+static void timer_task(void *nothing){
+	list_t *expired = TIMER_WHEEL_EXPIRED(&timers);
+
+	enter_critical();
+	while (1){
+		if (LIST_IS_EMPTY(expired)){
+			block(&daemon_wait, FOREVER);
+			continue;
+		}
+
+		swtimer *tmr = NODE_TO_TIMER(FIRST_OF(*expired));
+		list_remove(&tmr->node);
+		if (tmr->periodic){
+			tmr->node.value += tmr->period;
+			timer_wheel_insert(&timers, &tmr->node);
+		}
+
+		vfunc callback = tmr->callback;
+		void *para = tmr->para;
+		exit_critical();
+
+		// the timer may be stopped or deleted by the callback, do not touch it after here
+		callback(para);
+		enter_critical();
+	}
+}
+
+
+/*
+@ brief: Advance the timers and wake the timer task if any timer expired,
+         called by tick handler.
+*/
+void swtimer_tick(u_int now){
+	if (daemon == NULL)
+		return;
+
+	timer_wheel_advance(&timers, now);
+	if (LIST_NOT_EMPTY(TIMER_WHEEL_EXPIRED(&timers)) && LIST_NOT_EMPTY(&daemon_wait))
+		task_ready_isr(daemon);
+}
+
+
+/*
+@ brief: Get how many ticks later a timer may expire, used by tickless idle.
+*/
+u_int swtimer_next_expire(u_int now){
+	if (daemon == NULL)
+		return UINT_MAX;
+
+	return timer_wheel_next_expire(&timers, now);
+}
+
+
+// the timer task is created when the first timer is initialized
+static void service_init(void){
+	timer_wheel_init(&timers, os_get_tick());
+	list_init(&daemon_wait);
+	daemon = task_init(timer_task, "timer", NULL, CFG_SOFT_TIMER_PRIO,
+	                   daemon_stack, CFG_SOFT_TIMER_STACK_SIZE);
+}
+
+
+/*
+@ brief: Initialize a timer, it does not run until swtimer_start().
+@ param: period -> ticks from start to expire, and between two expires of a periodic timer.
+         periodic -> false: one-shot timer, stop after expired once.
+*/
+void swtimer_init(swtimer_t tmr, vfunc callback, void *para, u_int period, bool periodic){
+	os_assert(period > 0 && period <= INT_MAX);
+
+	enter_critical();
+	if (daemon == NULL)
+		service_init();
+	exit_critical();
+
+	LIST_NODE_INIT(&tmr->node);
+	tmr->callback = callback;
+	tmr->para = para;
+	tmr->period = period;
+	tmr->periodic = periodic;
+}
+
+
+swtimer_t swtimer_create(vfunc callback, void *para, u_int period, bool periodic){
+	swtimer *tmr = malloc(sizeof(swtimer));
+	if (tmr == NULL)
+		return NULL;
+
+	swtimer_init(tmr, callback, para, period, periodic);
+	return tmr;
+}
+
+
+int swtimer_delete(swtimer_t tmr){
+	if (!is_heap_addr(tmr))
+		return RET_FAILED;
+
+	swtimer_stop(tmr);
+	queue_free(tmr);
+	return RET_SUCCESS;
+}
+
+
+/*
+@ brief: Start the timer, it expires after period ticks.
+@ note: A timer that is already running is restarted from now.
+        Never blocks, can be called in isr.
+*/
+void swtimer_start(swtimer_t tmr){
+	enter_critical();
+	list_remove(&tmr->node);
+	tmr->node.value = os_get_tick() + tmr->period;
+	timer_wheel_insert(&timers, &tmr->node);
+	exit_critical();
+}
+
+
+/*
+@ brief: Stop the timer, its callback will not be called until started again.
+@ note: Never blocks, can be called in isr.
+*/
+void swtimer_stop(swtimer_t tmr){
+	enter_critical();
+	list_remove(&tmr->node);
+	exit_critical();
+}
+
+
+/*
+@ brief: Restart the timer from now, whether it is running or not.
+*/
+void swtimer_reset(swtimer_t tmr){
+	swtimer_start(tmr);
+}
+
+
+/*
+@ brief: Change the period and restart the timer from now.
+*/
+void swtimer_change_period(swtimer_t tmr, u_int period){
+	os_assert(period > 0 && period <= INT_MAX);
+
+	enter_critical();
+	tmr->period = period;
+	exit_critical();
+	swtimer_start(tmr);
+}
+
+
+bool swtimer_is_active(swtimer_t tmr){
+	return !IS_ORPHAN_NODE(&tmr->node);
+}
+
+#endif  // CFG_USE_SOFT_TIMER
@@ -0,0 +1,120 @@
+/*
+ * Kora rtos
+ * Copyright (c) 2024 biaboi
+ *
+ * This file is part of this project and is licensed under the MIT License.
+ * See the LICENSE file in the project root for full license information.
+ */
+
+
+#include "Kora.h"
+
+/**
+ * @file    notify_bench.c
+ * @brief   Target benchmark of task notification against semaphore, ping-pong.
+ *
+ * Two tasks wake each other ROUNDS times with each method, the higher one
+ * is woken first, so a round trip is two gives, two takes and two switches.
+ * The isr variants give inside a critical section, as an interrupt handler
+ * does, the switch happens when the section ends. The result is printed in
+ * port_timestamp() cycles (DWT CYCCNT on Cortex-M) per round trip.
+ *
+ * Add this file to a firmware project and call notify_bench_start() before
+ * Kora_start(), prio and prio + 1 must be free and above the idle task.
+ */
+
+#if CFG_TASK_NOTIFY_SLOTS > 0
+
+#define ROUNDS         1000
+#define BENCH_STACK    512
+#define BENCH_SLOT     0
+
+enum {bench_sem, bench_sem_isr, bench_notify, bench_notify_isr, bench_methods};
+
+static const char *method_name[bench_methods] = {
+	"sem_signal/sem_wait", "sem_signal_isr/sem_wait",
+	"task_notify/task_notify_wait", "task_notify_isr/task_notify_wait",
+};
+
+u_int port_timestamp(void);
+
+static cntsem       ping_sem, pong_sem;
+static task_handle  pinger, ponger;
+
+
+// wake the task waiting on s or on its notification slot
+static void give(int method, cntsem *s, task_handle tsk){
+	switch (method){
+	case bench_sem:
+		sem_signal(s);
+		break;
+
+	case bench_sem_isr:
+		enter_critical();
+		sem_signal_isr(s);
+		exit_critical();
+		break;
+
+	case bench_notify:
+		task_notify(tsk, BENCH_SLOT, 0, notify_increment);
+		break;
+
+	case bench_notify_isr:
+		enter_critical();
+		task_notify_isr(tsk, BENCH_SLOT, 0, notify_increment);
+		exit_critical();
+		break;
+	}
+}
+
+
+static void take(int method, cntsem *s){
+	if (method == bench_sem || method == bench_sem_isr)
+		sem_wait(s, FOREVER);
+	else
+		task_notify_wait(BENCH_SLOT, 0, ~0u, NULL, FOREVER);
+}
+
+
+// the higher task, answers every ping
+static void pong_task(void *nothing){
+	for (int m = 0; m < bench_methods; ++m){
+		for (int i = 0; i < ROUNDS; ++i){
+			take(m, &ping_sem);
+			give(m, &pong_sem, pinger);
+		}
+	}
+}
+
+
+static void ping_task(void *nothing){
+	sleep(10);    // let the system settle
+
+	for (int m = 0; m < bench_methods; ++m){
+		u_int begin = port_timestamp();
+		for (int i = 0; i < ROUNDS; ++i){
+			give(m, &ping_sem, ponger);
+			take(m, &pong_sem);
+		}
+		u_int cycles = (port_timestamp() - begin) / ROUNDS;
+
+		enter_critical();
+		kn_print("%-34s %6u cycles per round trip\r\n", method_name[m], cycles);
+		exit_critical();
+	}
+}
+
+
+/*
+@ brief: Create the two benchmark tasks, the result is printed when done.
+*/
+void notify_bench_start(u_int prio){
+	os_assert(prio + 1 < CFG_MAX_PRIOS - 1);
+
+	sem_init(&ping_sem, 1, 0);
+	sem_init(&pong_sem, 1, 0);
+	ponger = task_create(pong_task, "pong", NULL, prio, BENCH_STACK);
+	pinger = task_create(ping_task, "ping", NULL, prio + 1, BENCH_STACK);
+}
+
+#endif  // CFG_TASK_NOTIFY_SLOTS
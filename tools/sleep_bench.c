@@ -0,0 +1,167 @@
+/*
+ * Kora rtos
+ * Copyright (c) 2024 biaboi
+ *
+ * This file is part of this project and is licensed under the MIT License.
+ * See the LICENSE file in the project root for full license information.
+ */
+
+/**
+ * @file    sleep_bench.c
+ * @brief   Host benchmark of the sleep queue backends, sorted list against timer wheel.
+ *
+ * N sleepers with random timeouts are kept mounted. Each tick the due ones
+ * are taken away and mounted again with a new timeout, the way tasks sleep
+ * in a loop. Reported per backend:
+ *   insert -> ns per insert into a queue holding N sleepers
+ *   tick   -> ns per tick, advance plus taking and re-inserting the due ones
+ *
+ * Build and run from the repository root, the config template is used as is:
+ *   mkdir -p build && cp inc/KoraConfigTemplate.h build/KoraConfig.h
+ *   gcc -O2 -Ibuild -Iinc tools/sleep_bench.c dataStruct/timerWheel.c \
+ *       dataStruct/list.c -o build/sleep_bench
+ *   ./build/sleep_bench
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "list.h"
+#include "timerWheel.h"
+
+#define MAX_SLEEPERS     4096
+#define MAX_TIMEOUT      5000          // ticks, a sleep of up to 5 s at 1 kHz
+#define INSERT_ROUNDS    200000
+#define TICK_ROUNDS      100000
+
+static list_node_t   nodes[MAX_SLEEPERS];
+static list_t        sleep_list;
+static timer_wheel   wheel;
+
+
+static double now_ns(void){
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+
+static u_int timeout(void){
+	return 1 + rand() % MAX_TIMEOUT;
+}
+
+
+/*
+@ brief: Time inserting into a sorted list that holds n sleepers, as add_to_sleep() did.
+*/
+static double list_insert_ns(int n){
+	list_init(&sleep_list);
+	for (int i = 0; i < n; ++i){
+		LIST_NODE_INIT(nodes + i);
+		nodes[i].value = timeout();
+		list_insert(&sleep_list, nodes + i);
+	}
+
+	list_node_t *probe = nodes + n;
+	double begin = now_ns();
+	for (int r = 0; r < INSERT_ROUNDS; ++r){
+		LIST_NODE_INIT(probe);
+		probe->value = timeout();
+		list_insert(&sleep_list, probe);
+		list_remove(probe);
+	}
+	return (now_ns() - begin) / INSERT_ROUNDS;
+}
+
+
+static double wheel_insert_ns(int n){
+	timer_wheel_init(&wheel, 0);
+	for (int i = 0; i < n; ++i){
+		LIST_NODE_INIT(nodes + i);
+		nodes[i].value = timeout();
+		timer_wheel_insert(&wheel, nodes + i);
+	}
+
+	list_node_t *probe = nodes + n;
+	double begin = now_ns();
+	for (int r = 0; r < INSERT_ROUNDS; ++r){
+		LIST_NODE_INIT(probe);
+		probe->value = timeout();
+		timer_wheel_insert(&wheel, probe);
+		list_remove(probe);
+	}
+	return (now_ns() - begin) / INSERT_ROUNDS;
+}
+
+
+/*
+@ brief: Time the ticks of a sorted list with n sleepers, due ones sleep again.
+*/
+static double list_tick_ns(int n){
+	list_init(&sleep_list);
+	for (int i = 0; i < n; ++i){
+		LIST_NODE_INIT(nodes + i);
+		nodes[i].value = timeout();
+		list_insert(&sleep_list, nodes + i);
+	}
+
+	double begin = now_ns();
+	for (u_int now = 1; now <= TICK_ROUNDS; ++now){
+		while (LIST_NOT_EMPTY(&sleep_list) && (int)(FIRST_OF(sleep_list)->value - now) <= 0){
+			list_node_t *node = FIRST_OF(sleep_list);
+			list_remove(node);
+			node->value = now + timeout();
+			list_insert(&sleep_list, node);
+		}
+	}
+	return (now_ns() - begin) / TICK_ROUNDS;
+}
+
+
+static double wheel_tick_ns(int n){
+	timer_wheel_init(&wheel, 0);
+	for (int i = 0; i < n; ++i){
+		LIST_NODE_INIT(nodes + i);
+		nodes[i].value = timeout();
+		timer_wheel_insert(&wheel, nodes + i);
+	}
+
+	list_t *expired = TIMER_WHEEL_EXPIRED(&wheel);
+	double begin = now_ns();
+	for (u_int now = 1; now <= TICK_ROUNDS; ++now){
+		timer_wheel_advance(&wheel, now);
+		while (LIST_NOT_EMPTY(expired)){
+			list_node_t *node = FIRST_OF(*expired);
+			list_remove(node);
+			node->value = now + timeout();
+			timer_wheel_insert(&wheel, node);
+		}
+	}
+	return (now_ns() - begin) / TICK_ROUNDS;
+}
+
+
+int main(void){
+	static const int sizes[] = {16, 64, 256, 1024, 4000};
+
+	printf("timer wheel: %u slots per level, span %u ticks, timeouts 1..%d ticks\n\n",
+	       TW_SLOTS, TW_SPAN, MAX_TIMEOUT);
+	printf("%8s  %14s  %14s  %14s  %14s\n", "sleepers",
+	       "list insert", "wheel insert", "list tick", "wheel tick");
+
+	for (int i = 0; i < sizeof(sizes) / sizeof(sizes[0]); ++i){
+		int n = sizes[i];
+		srand(1);
+		double li = list_insert_ns(n);
+		srand(1);
+		double wi = wheel_insert_ns(n);
+		srand(1);
+		double lt = list_tick_ns(n);
+		srand(1);
+		double wt = wheel_tick_ns(n);
+
+		printf("%8d  %11.1f ns  %11.1f ns  %11.1f ns  %11.1f ns\n", n, li, wi, lt, wt);
+	}
+	return 0;
+}
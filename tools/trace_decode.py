@@ -0,0 +1,107 @@
+#!/usr/bin/env python3
+"""
+Kora rtos trace decoder.
+
+Reads a binary dump produced by trace_dump() (component/trace.c) and prints
+the kernel events as a timeline.
+
+usage: trace_decode.py dump.bin [--csv]
+"""
+
+import struct
+import sys
+
+HEADER = struct.Struct("<IHHIII")
+RECORD = struct.Struct("<IBBHI")
+MAGIC = 0x4352544B
+
+# keep in the same order as trace_event_t in inc/trace.h
+EVENTS = [
+    "task_create", "task_name", "task_delete", "task_switch",
+    "task_ready", "task_block", "task_sleep", "task_suspend",
+    "sem_wait", "sem_signal", "mutex_lock", "mutex_unlock",
+    "msgq_push", "msgq_front", "evt_wait", "evt_set",
+    "streamq_push", "streamq_front",
+    "isr_enter", "isr_exit", "malloc", "free",
+]
+
+# events whose object is a tcb address
+TCB_EVENTS = {"task_create", "task_delete", "task_switch", "task_ready", "task_suspend"}
+
+# events whose object is a plain number
+NUM_EVENTS = {"task_sleep", "isr_enter", "isr_exit"}
+
+
+def read_dump(path):
+    with open(path, "rb") as f:
+        data = f.read()
+
+    magic, version, rec_size, count, dropped, hz = HEADER.unpack_from(data, 0)
+    if magic != MAGIC:
+        sys.exit("not a Kora trace dump")
+    if rec_size != RECORD.size:
+        sys.exit("unsupported record size %d" % rec_size)
+
+    records = [RECORD.unpack_from(data, HEADER.size + i * rec_size) for i in range(count)]
+    return dropped, hz, records
+
+
+def decode(records, hz):
+    names = {}       # trace id -> task name
+    tcbs = {}        # tcb address -> trace id
+    creating = None  # trace id of the task whose name records follow
+    high = 0
+    last_stamp = None
+
+    for stamp, event, task, arg, obj in records:
+        # timestamps are 32-bit cycles, unwrap them in record order
+        if last_stamp is not None and stamp < last_stamp:
+            high += 1 << 32
+        last_stamp = stamp
+        time_us = (high + stamp) * 1e6 / hz
+
+        name = EVENTS[event] if event < len(EVENTS) else "event_%d" % event
+
+        if name == "task_create":
+            tcbs[obj] = arg
+            names[arg] = ""
+            creating = arg
+        elif name == "task_name":
+            if creating is not None:
+                names[creating] += struct.pack("<I", obj).rstrip(b"\0").decode("ascii", "replace")
+            continue
+        else:
+            creating = None
+
+        running = "-" if task == 0xFF else names.get(task) or "#%d" % task
+        if name in TCB_EVENTS and obj in tcbs:
+            target = names.get(tcbs[obj]) or "#%d" % tcbs[obj]
+        elif name in NUM_EVENTS:
+            target = str(obj)
+        else:
+            target = "0x%08X" % obj
+
+        yield time_us, running, name, target
+
+
+def main():
+    if len(sys.argv) < 2:
+        sys.exit(__doc__)
+
+    dropped, hz, records = read_dump(sys.argv[1])
+    csv = "--csv" in sys.argv
+
+    if csv:
+        print("time_us,task,event,object")
+    else:
+        print("# %d records, %d dropped, timestamp %d Hz" % (len(records), dropped, hz))
+
+    for time_us, running, name, target in decode(records, hz):
+        if csv:
+            print("%.3f,%s,%s,%s" % (time_us, running, name, target))
+        else:
+            print("%14.3f us  %-16s %-14s %s" % (time_us, running, name, target))
+
+
+if __name__ == "__main__":
+    main()